@@ -0,0 +1,219 @@
+#include "AssetPack.h"
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char PACK_MAGIC[4] = { 'A', 'P', 'A', 'K' };
+static const uint32_t PACK_VERSION = 2;
+
+struct AssetPackHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t entryCount;
+	uint32_t alignment;
+	uint64_t size;        // of the whole pack, to catch truncated files
+	uint64_t contentsVersion;
+};
+
+AssetPack::AssetPack()
+	: mapping(0), mappedSize(0), entries(0), entryCount(0)
+{
+}
+
+AssetPack::~AssetPack()
+{
+	close();
+}
+
+bool AssetPack::open(const char* path, uint64_t contentsVersion)
+{
+	close();
+
+	// The mapping keeps the file open, so neither platform holds on to a handle
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER fileSize;
+	HANDLE section = NULL;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+		section = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (!section)
+		return false;
+	mapping = (const unsigned char*)MapViewOfFile(section, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(section);
+	if (!mapping)
+		return false;
+	mappedSize = (size_t)fileSize.QuadPart;
+#else
+	int file = ::open(path, O_RDONLY);
+	if (file < 0)
+		return false;
+	struct stat status;
+	void* view = MAP_FAILED;
+	if (fstat(file, &status) == 0 && status.st_size > 0)
+		view = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	::close(file);
+	if (view == MAP_FAILED)
+		return false;
+	// Everything in the pack is read at startup: start paging it in now
+	madvise(view, (size_t)status.st_size, MADV_WILLNEED);
+	mapping = (const unsigned char*)view;
+	mappedSize = (size_t)status.st_size;
+#endif
+
+	AssetPackHeader header;
+	bool valid = mappedSize >= sizeof(header);
+	if (valid)
+	{
+		memcpy(&header, mapping, sizeof(header));
+		valid = memcmp(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC)) == 0 && header.version == PACK_VERSION
+			&& header.alignment == ALIGNMENT && header.size == mappedSize
+			&& header.entryCount <= (mappedSize - sizeof(header)) / sizeof(AssetPackEntry);
+	}
+	if (valid)
+	{
+		entries = (const AssetPackEntry*)(mapping + sizeof(header));
+		entryCount = header.entryCount;
+		for (uint32_t i = 0; valid && i < entryCount; ++i)
+		{
+			const AssetPackEntry& entry = entries[i];
+			valid = memchr(entry.name, 0, sizeof(entry.name)) != 0 && entry.offset % ALIGNMENT == 0
+				&& entry.offset <= mappedSize && entry.size <= mappedSize - entry.offset;
+		}
+	}
+	if (!valid)
+	{
+		std::cout << path << " is not an asset pack this build can read" << std::endl;
+		close();
+	}
+	else if (header.contentsVersion != contentsVersion)
+	{
+		std::cout << path << " was written for other meshes or shaders than this build's; write it again" << std::endl;
+		close();
+		valid = false;
+	}
+	return valid;
+}
+
+void AssetPack::close()
+{
+	if (mapping)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(mapping);
+#else
+		munmap((void*)mapping, mappedSize);
+#endif
+	}
+	mapping = 0;
+	mappedSize = 0;
+	entries = 0;
+	entryCount = 0;
+}
+
+const AssetPackEntry* AssetPack::find(const char* name, AssetKind kind) const
+{
+	for (uint32_t i = 0; i < entryCount; ++i)
+		if (entries[i].kind == (uint32_t)kind && strcmp(entries[i].name, name) == 0)
+			return &entries[i];
+	return 0;
+}
+
+// 64-bit FNV-1a
+uint64_t AssetPack::hash(const unsigned char* data, size_t size)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= data[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+bool AssetPackWriter::add(const char* name, AssetKind kind, const void* data, size_t size)
+{
+	if (strlen(name) >= sizeof(((AssetPackEntry*)0)->name))
+		return false;
+	for (size_t i = 0; i < blobs.size(); ++i)
+		if (blobs[i].name == name)
+			return false;
+
+	blobs.push_back(Blob());
+	blobs.back().name = name;
+	blobs.back().kind = kind;
+	blobs.back().data.assign((const unsigned char*)data, (const unsigned char*)data + size);
+	return true;
+}
+
+bool AssetPackWriter::write(const char* path, uint64_t contentsVersion) const
+{
+	AssetPackHeader header;
+	memcpy(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC));
+	header.version = PACK_VERSION;
+	header.entryCount = (uint32_t)blobs.size();
+	header.alignment = AssetPack::ALIGNMENT;
+	header.contentsVersion = contentsVersion;
+
+	// Lay out the blobs after the entry table; a blob identical to an earlier one points at its bytes
+	std::vector<AssetPackEntry> table(blobs.size());
+	std::vector<bool> stored(blobs.size(), false);
+	uint64_t offset = sizeof(header) + table.size() * sizeof(AssetPackEntry);
+	for (size_t i = 0; i < blobs.size(); ++i)
+	{
+		AssetPackEntry& entry = table[i];
+		memset(&entry, 0, sizeof(entry));
+		memcpy(entry.name, blobs[i].name.c_str(), blobs[i].name.size() + 1);
+		entry.kind = blobs[i].kind;
+		entry.size = blobs[i].data.size();
+		entry.hash = AssetPack::hash(blobs[i].data.data(), blobs[i].data.size());
+
+		size_t same = 0;
+		while (same < i && (table[same].hash != entry.hash || blobs[same].data != blobs[i].data))
+			++same;
+		if (same < i)
+		{
+			entry.offset = table[same].offset;
+			continue;
+		}
+		offset = (offset + AssetPack::ALIGNMENT - 1) / AssetPack::ALIGNMENT * AssetPack::ALIGNMENT;
+		entry.offset = offset;
+		offset += entry.size;
+		stored[i] = true;
+	}
+	header.size = offset;
+
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		return false;
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+		&& (table.empty() || fwrite(table.data(), sizeof(AssetPackEntry), table.size(), file) == table.size());
+
+	static const unsigned char PADDING[AssetPack::ALIGNMENT] = {};
+	uint64_t written = sizeof(header) + table.size() * sizeof(AssetPackEntry);
+	for (size_t i = 0; ok && i < blobs.size(); ++i)
+	{
+		if (!stored[i])
+			continue;
+		size_t padding = (size_t)(table[i].offset - written);
+		ok = (padding == 0 || fwrite(PADDING, padding, 1, file) == 1)
+			&& (blobs[i].data.empty() || fwrite(blobs[i].data.data(), blobs[i].data.size(), 1, file) == 1);
+		written = table[i].offset + blobs[i].data.size();
+	}
+
+	return fclose(file) == 0 && ok;
+}
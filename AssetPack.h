@@ -0,0 +1,73 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// What an asset pack entry holds; the pack itself treats every blob as plain bytes
+enum AssetKind
+{
+	ASSET_TEXTURE = 1,   // a KTX2 file, block-compressed or pre-decoded, with its mip chain
+	ASSET_BUFFER = 2,    // vertex, index or other GPU buffer contents, uploaded as they are
+	ASSET_SHADER = 3     // GLSL source, null-terminated
+};
+
+// One blob of a pack, found by name. Blobs with identical contents share their bytes.
+struct AssetPackEntry
+{
+	char name[48];       // null-terminated
+	uint32_t kind;       // AssetKind
+	uint32_t reserved;
+	uint64_t offset;     // from the start of the pack, a multiple of AssetPack::ALIGNMENT
+	uint64_t size;
+	uint64_t hash;       // 64-bit FNV-1a of the contents, computed by the writer
+};
+
+// Single-file archive of everything the renderer loads at startup: a header, the entry table,
+// then every blob aligned to ALIGNMENT, all little-endian. The pack is memory-mapped
+// whole, so opening it is one open and one map, and blobs are read straight from the mapping.
+// The header carries a contents version chosen by the writer, standing for whatever the blobs
+// depend on (struct layouts, the sources they replace); a pack is only opened by the same version.
+class AssetPack
+{
+	const unsigned char* mapping;
+	size_t mappedSize;
+	const AssetPackEntry* entries;
+	uint32_t entryCount;
+
+public:
+	static const uint32_t ALIGNMENT = 64;
+
+	AssetPack();
+	~AssetPack();
+
+	// Maps the file and validates its header and entry table; packs of another contents version are refused
+	bool open(const char* path, uint64_t contentsVersion);
+	void close();
+	bool isOpen() const { return mapping != 0; }
+
+	// Entry of that name and kind, or null. Packs hold a handful of entries, so this is a linear scan.
+	const AssetPackEntry* find(const char* name, AssetKind kind) const;
+	const unsigned char* data(const AssetPackEntry& entry) const { return mapping + entry.offset; }
+
+	static uint64_t hash(const unsigned char* data, size_t size);
+};
+
+// Collects blobs and writes them out as a pack
+class AssetPackWriter
+{
+	struct Blob
+	{
+		std::string name;
+		uint32_t kind;
+		std::vector<unsigned char> data;
+	};
+
+	std::vector<Blob> blobs;
+
+public:
+	// False when the name is too long or already taken
+	bool add(const char* name, AssetKind kind, const void* data, size_t size);
+
+	bool write(const char* path, uint64_t contentsVersion) const;
+};
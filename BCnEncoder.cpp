@@ -0,0 +1,319 @@
+#include "BCnEncoder.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BCN_SSE2
+#endif
+
+// One 4x4 block's colours as structure-of-arrays, 0-255
+struct ColorBlock
+{
+	float r[16];
+	float g[16];
+	float b[16];
+};
+
+static uint16_t packRGB565(const float* rgb)
+{
+	int r = std::min(31, std::max(0, (int)(rgb[0] * (31.0f / 255.0f) + 0.5f)));
+	int g = std::min(63, std::max(0, (int)(rgb[1] * (63.0f / 255.0f) + 0.5f)));
+	int b = std::min(31, std::max(0, (int)(rgb[2] * (31.0f / 255.0f) + 0.5f)));
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void unpackRGB565(uint16_t color, float* rgb)
+{
+	int r = color >> 11;
+	int g = (color >> 5) & 63;
+	int b = color & 31;
+	rgb[0] = (float)((r << 3) | (r >> 2));
+	rgb[1] = (float)((g << 2) | (g >> 4));
+	rgb[2] = (float)((b << 3) | (b >> 2));
+}
+
+// Picks the nearest of the 4 palette colours for every pixel; returns the block's squared error
+static float selectIndices(const ColorBlock& block, const float palette[4][3], unsigned char indices[16])
+{
+	float error = 0.0f;
+#ifdef BCN_SSE2
+	for (int i = 0; i < 16; i += 4)
+	{
+		__m128 r = _mm_loadu_ps(block.r + i);
+		__m128 g = _mm_loadu_ps(block.g + i);
+		__m128 b = _mm_loadu_ps(block.b + i);
+		__m128 best = _mm_set1_ps(1e30f);
+		__m128i bestIndex = _mm_setzero_si128();
+		for (int p = 0; p < 4; ++p)
+		{
+			__m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[p][0]));
+			__m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette[p][1]));
+			__m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[p][2]));
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+			__m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+			best = _mm_min_ps(distance, best);
+			bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(p)), _mm_andnot_si128(closer, bestIndex));
+		}
+
+		int32_t lanes[4];
+		float errors[4];
+		_mm_storeu_si128((__m128i*)lanes, bestIndex);
+		_mm_storeu_ps(errors, best);
+		for (int j = 0; j < 4; ++j)
+		{
+			indices[i + j] = (unsigned char)lanes[j];
+			error += errors[j];
+		}
+	}
+#else
+	for (int i = 0; i < 16; ++i)
+	{
+		float best = 1e30f;
+		for (int p = 0; p < 4; ++p)
+		{
+			float dr = block.r[i] - palette[p][0];
+			float dg = block.g[i] - palette[p][1];
+			float db = block.b[i] - palette[p][2];
+			float distance = dr * dr + dg * dg + db * db;
+			if (distance < best)
+			{
+				best = distance;
+				indices[i] = (unsigned char)p;
+			}
+		}
+		error += best;
+	}
+#endif
+	return error;
+}
+
+// Quantizes a pair of endpoints and picks indices for them; returns the squared error
+static float fitEndpoints(const ColorBlock& block, const float* end0, const float* end1, uint16_t& color0, uint16_t& color1, unsigned char indices[16])
+{
+	color0 = packRGB565(end0);
+	color1 = packRGB565(end1);
+	// color0 > color1 selects the 4-colour mode
+	if (color0 < color1)
+		std::swap(color0, color1);
+
+	float palette[4][3];
+	unpackRGB565(color0, palette[0]);
+	unpackRGB565(color1, palette[1]);
+	for (int c = 0; c < 3; ++c)
+	{
+		palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+		palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+	}
+	return selectIndices(block, palette, indices);
+}
+
+void BCnEncoder::encodeColorBlock(const unsigned char* rgba, unsigned char* out)
+{
+	ColorBlock block;
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; ++i)
+	{
+		block.r[i] = rgba[i * 4 + 0];
+		block.g[i] = rgba[i * 4 + 1];
+		block.b[i] = rgba[i * 4 + 2];
+		mean[0] += block.r[i];
+		mean[1] += block.g[i];
+		mean[2] += block.b[i];
+	}
+	for (int c = 0; c < 3; ++c)
+		mean[c] /= 16.0f;
+
+	// Covariance, then its principal axis by power iteration
+	float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; ++i)
+	{
+		float r = block.r[i] - mean[0];
+		float g = block.g[i] - mean[1];
+		float b = block.b[i] - mean[2];
+		cov[0] += r * r;
+		cov[1] += r * g;
+		cov[2] += r * b;
+		cov[3] += g * g;
+		cov[4] += g * b;
+		cov[5] += b * b;
+	}
+	float axis[3] = { 1.0f, 1.0f, 1.0f };
+	for (int iteration = 0; iteration < 8; ++iteration)
+	{
+		float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+		float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+		float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+		float largest = std::max(std::fabs(x), std::max(std::fabs(y), std::fabs(z)));
+		if (largest < 1e-6f)
+			break; // flat block, any axis works
+		axis[0] = x / largest;
+		axis[1] = y / largest;
+		axis[2] = z / largest;
+	}
+	float length2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+
+	// Endpoints at the extreme projections onto the axis
+	float minT = 0.0f, maxT = 0.0f;
+	for (int i = 0; i < 16; ++i)
+	{
+		float t = ((block.r[i] - mean[0]) * axis[0] + (block.g[i] - mean[1]) * axis[1] + (block.b[i] - mean[2]) * axis[2]) / length2;
+		minT = std::min(minT, t);
+		maxT = std::max(maxT, t);
+	}
+	float end0[3], end1[3];
+	for (int c = 0; c < 3; ++c)
+	{
+		end0[c] = std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * maxT));
+		end1[c] = std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * minT));
+	}
+
+	uint16_t color0, color1;
+	unsigned char indices[16];
+	float error = fitEndpoints(block, end0, end1, color0, color1, indices);
+
+	// One least-squares refit of the endpoints to the chosen indices, kept when it helps
+	static const float WEIGHT0[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	float ax[3] = { 0.0f, 0.0f, 0.0f }, bx[3] = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; ++i)
+	{
+		float a = WEIGHT0[indices[i]];
+		float b = 1.0f - a;
+		float pixel[3] = { block.r[i], block.g[i], block.b[i] };
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (int c = 0; c < 3; ++c)
+		{
+			ax[c] += a * pixel[c];
+			bx[c] += b * pixel[c];
+		}
+	}
+	float determinant = aa * bb - ab * ab;
+	if (std::fabs(determinant) > 1e-6f && color0 != color1)
+	{
+		float refit0[3], refit1[3];
+		for (int c = 0; c < 3; ++c)
+		{
+			refit0[c] = std::min(255.0f, std::max(0.0f, (bb * ax[c] - ab * bx[c]) / determinant));
+			refit1[c] = std::min(255.0f, std::max(0.0f, (aa * bx[c] - ab * ax[c]) / determinant));
+		}
+		uint16_t refitColor0, refitColor1;
+		unsigned char refitIndices[16];
+		if (fitEndpoints(block, refit0, refit1, refitColor0, refitColor1, refitIndices) < error)
+		{
+			color0 = refitColor0;
+			color1 = refitColor1;
+			memcpy(indices, refitIndices, sizeof(indices));
+		}
+	}
+
+	uint32_t bits = 0;
+	for (int i = 0; i < 16; ++i)
+		bits |= (uint32_t)indices[i] << (i * 2);
+	out[0] = (unsigned char)(color0 & 0xFF);
+	out[1] = (unsigned char)(color0 >> 8);
+	out[2] = (unsigned char)(color1 & 0xFF);
+	out[3] = (unsigned char)(color1 >> 8);
+	for (int i = 0; i < 4; ++i)
+		out[4 + i] = (unsigned char)(bits >> (i * 8));
+}
+
+void BCnEncoder::encodeAlphaBlock(const unsigned char* rgba, unsigned char* out)
+{
+	int alpha0 = 0, alpha1 = 255;
+	for (int i = 0; i < 16; ++i)
+	{
+		alpha0 = std::max(alpha0, (int)rgba[i * 4 + 3]);
+		alpha1 = std::min(alpha1, (int)rgba[i * 4 + 3]);
+	}
+	memset(out, 0, 8);
+	out[0] = (unsigned char)alpha0;
+	out[1] = (unsigned char)alpha1;
+	if (alpha0 == alpha1)
+		return;
+
+	// alpha0 > alpha1: 8-value mode, indices 2-7 step from alpha0 towards alpha1
+	int palette[8];
+	palette[0] = alpha0;
+	palette[1] = alpha1;
+	for (int k = 1; k <= 6; ++k)
+		palette[k + 1] = ((7 - k) * alpha0 + k * alpha1) / 7;
+
+	uint64_t bits = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		int value = rgba[i * 4 + 3];
+		int best = 0;
+		for (int p = 1; p < 8; ++p)
+			if (std::abs(palette[p] - value) < std::abs(palette[best] - value))
+				best = p;
+		bits |= (uint64_t)best << (i * 3);
+	}
+	for (int i = 0; i < 6; ++i)
+		out[2 + i] = (unsigned char)(bits >> (i * 8));
+}
+
+size_t BCnEncoder::blockBytes(BCnFormat format)
+{
+	return format == BCN_BC1 ? 8 : 16;
+}
+
+size_t BCnEncoder::encodedSize(BCnFormat format, int width, int height)
+{
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+void BCnEncoder::encodeRows(BCnFormat format, const unsigned char* rgba, int width, int height, int firstRow, int endRow, unsigned char* out)
+{
+	const int blocksX = (width + 3) / 4;
+	const size_t size = blockBytes(format);
+	unsigned char block[64];
+
+	for (int by = firstRow; by < endRow; ++by)
+	{
+		for (int bx = 0; bx < blocksX; ++bx)
+		{
+			for (int y = 0; y < 4; ++y)
+			{
+				int sy = std::min(by * 4 + y, height - 1);
+				for (int x = 0; x < 4; ++x)
+				{
+					int sx = std::min(bx * 4 + x, width - 1);
+					memcpy(block + (y * 4 + x) * 4, rgba + ((size_t)sy * width + sx) * 4, 4);
+				}
+			}
+
+			unsigned char* target = out + ((size_t)by * blocksX + bx) * size;
+			if (format == BCN_BC3)
+			{
+				encodeAlphaBlock(block, target);
+				target += 8;
+			}
+			encodeColorBlock(block, target);
+		}
+	}
+}
+
+void BCnEncoder::encode(BCnFormat format, const unsigned char* rgba, int width, int height, unsigned char* out, int threadCount)
+{
+	const int blocksY = (height + 3) / 4;
+	int count = std::max(1, std::min(threadCount, blocksY));
+
+	std::vector<std::thread> threads;
+	for (int t = 1; t < count; ++t)
+	{
+		int first = blocksY * t / count;
+		int end = blocksY * (t + 1) / count;
+		threads.push_back(std::thread(&BCnEncoder::encodeRows, format, rgba, width, height, first, end, out));
+	}
+	encodeRows(format, rgba, width, height, 0, blocksY / count, out);
+	for (size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <cstddef>
+
+// Block-compressed formats the encoder writes
+enum BCnFormat
+{
+	BCN_BC1,     // opaque RGB, 8 bytes per 4x4 block
+	BCN_BC3      // RGB plus interpolated alpha, 16 bytes per 4x4 block
+};
+
+// Encodes RGBA8 images to BC1 or BC3. Colour endpoints are fit along each block's principal
+// axis and refined once by least squares; the nearest-palette search runs on 4 pixels per
+// SSE instruction. Rows of blocks are spread over worker threads.
+class BCnEncoder
+{
+	static void encodeRows(BCnFormat format, const unsigned char* rgba, int width, int height, int firstRow, int endRow, unsigned char* out);
+	static void encodeColorBlock(const unsigned char* block, unsigned char* out);
+	static void encodeAlphaBlock(const unsigned char* block, unsigned char* out);
+
+public:
+	static size_t blockBytes(BCnFormat format);
+	static size_t encodedSize(BCnFormat format, int width, int height);
+
+	// Encodes a tightly packed RGBA8 image into encodedSize() bytes at out. Blocks crossing the
+	// right or bottom edge repeat the last column and row.
+	static void encode(BCnFormat format, const unsigned char* rgba, int width, int height, unsigned char* out, int threadCount);
+};
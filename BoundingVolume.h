@@ -0,0 +1,45 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cmath>
+
+// Object-space bounds of a mesh: an axis-aligned box and a sphere centered on the box
+struct BoundingVolume
+{
+	glm::vec3 aabbMin;
+	glm::vec3 aabbMax;
+	glm::vec3 center;
+	float radius;
+
+	// Bounds of count positions laid out stride bytes apart (stride lets this read straight from vertex arrays)
+	static BoundingVolume fromPositions(const glm::vec3* positions, size_t count, size_t stride)
+	{
+		BoundingVolume ret;
+		ret.aabbMin = ret.aabbMax = ret.center = glm::vec3(0.0f);
+		ret.radius = 0.0f;
+		if (count == 0)
+			return ret;
+
+		const char* bytes = reinterpret_cast<const char*>(positions);
+		ret.aabbMin = ret.aabbMax = *positions;
+		for (size_t i = 1; i < count; i++)
+		{
+			const glm::vec3& p = *reinterpret_cast<const glm::vec3*>(bytes + i * stride);
+			ret.aabbMin = glm::min(ret.aabbMin, p);
+			ret.aabbMax = glm::max(ret.aabbMax, p);
+		}
+
+		// Farthest point from the box center, tighter than half the box diagonal
+		ret.center = (ret.aabbMin + ret.aabbMax) * 0.5f;
+		float radiusSquared = 0.0f;
+		for (size_t i = 0; i < count; i++)
+		{
+			glm::vec3 offset = *reinterpret_cast<const glm::vec3*>(bytes + i * stride) - ret.center;
+			float distanceSquared = glm::dot(offset, offset);
+			if (distanceSquared > radiusSquared)
+				radiusSquared = distanceSquared;
+		}
+		ret.radius = std::sqrt(radiusSquared);
+		return ret;
+	}
+};
@@ -0,0 +1,104 @@
+#include "CPUProfiler.h"
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <cstdio>
+
+// Every thread buffer ever created. Buffers are never freed, so a dump still sees threads that have exited.
+static std::mutex gRegistryMutex;
+static std::vector<CPUProfiler::ThreadBuffer*> gThreadBuffers;
+
+// Trace timestamps start at program start
+static const uint64_t gStartNs = CPUProfiler::nowNs();
+
+uint64_t CPUProfiler::nowNs()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Registers the calling thread's buffer on its first marker; only that first call takes the lock
+CPUProfiler::ThreadBuffer* CPUProfiler::threadBuffer()
+{
+	static thread_local ThreadBuffer* buffer = 0;
+	if (!buffer)
+	{
+		buffer = new ThreadBuffer();
+		buffer->head.store(0, std::memory_order_relaxed);
+
+		std::lock_guard<std::mutex> lock(gRegistryMutex);
+		buffer->threadId = (uint32_t)gThreadBuffers.size() + 1;
+		gThreadBuffers.push_back(buffer);
+	}
+	return buffer;
+}
+
+void CPUProfiler::record(const char* name, uint64_t startNs, uint64_t endNs)
+{
+	ThreadBuffer* buffer = threadBuffer();
+	uint64_t head = buffer->head.load(std::memory_order_relaxed);
+
+	CPUProfileEvent& event = buffer->events[head % EVENTS_PER_THREAD];
+	event.name = name;
+	event.startNs = startNs;
+	event.durationNs = endNs - startNs;
+
+	// Publish the event to readers
+	buffer->head.store(head + 1, std::memory_order_release);
+}
+
+// Writes a JSON string, escaping the characters JSON reserves
+static void writeJsonString(FILE* file, const char* text)
+{
+	fputc('"', file);
+	for (const char* c = text; *c; ++c)
+	{
+		if (*c == '"' || *c == '\\')
+			fputc('\\', file);
+		if ((unsigned char)*c >= 0x20)
+			fputc(*c, file);
+	}
+	fputc('"', file);
+}
+
+bool CPUProfiler::writeChromeTrace(const char* path)
+{
+	FILE* file = fopen(path, "w");
+	if (!file)
+		return false;
+
+	std::vector<ThreadBuffer*> buffers;
+	{
+		std::lock_guard<std::mutex> lock(gRegistryMutex);
+		buffers = gThreadBuffers;
+	}
+
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	bool first = true;
+	for (size_t b = 0; b < buffers.size(); ++b)
+	{
+		ThreadBuffer* buffer = buffers[b];
+		uint64_t head = buffer->head.load(std::memory_order_acquire);
+		uint64_t begin = head > EVENTS_PER_THREAD ? head - EVENTS_PER_THREAD : 0;
+
+		for (uint64_t i = begin; i < head; ++i)
+		{
+			CPUProfileEvent event = buffer->events[i % EVENTS_PER_THREAD];
+
+			// The owning thread may have wrapped around onto this slot while we were reading it. It fills
+			// slot head % EVENTS_PER_THREAD before publishing head + 1, so a head of i + EVENTS_PER_THREAD
+			// already means the slot is being rewritten. The fence keeps the re-read after the copy.
+			std::atomic_thread_fence(std::memory_order_acquire);
+			uint64_t latest = buffer->head.load(std::memory_order_relaxed);
+			if (latest >= i + EVENTS_PER_THREAD)
+				continue;
+
+			fprintf(file, "%s\n{\"name\":", first ? "" : ",");
+			writeJsonString(file, event.name);
+			fprintf(file, ",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				buffer->threadId, (event.startNs - gStartNs) / 1000.0, event.durationNs / 1000.0);
+			first = false;
+		}
+	}
+	fprintf(file, "\n]}\n");
+	return fclose(file) == 0;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// Scoped CPU markers recorded into per-thread ring buffers and dumped as a Chrome trace
+// (chrome://tracing or ui.perfetto.dev). Recording a marker is two clock reads and a store
+// into the calling thread's own buffer: no locks and no allocation, so markers can stay
+// enabled in release builds. Define CPU_PROFILER_DISABLED to compile them out entirely.
+
+// One completed scope
+struct CPUProfileEvent
+{
+	const char* name;                // String literal or __FUNCTION__, never copied
+	uint64_t startNs;
+	uint64_t durationNs;
+};
+
+class CPUProfiler
+{
+public:
+	static const uint32_t EVENTS_PER_THREAD = 1 << 16; // oldest events are overwritten
+
+	// Ring owned by one thread. Only that thread writes; dumps read behind the published head.
+	struct ThreadBuffer
+	{
+		uint32_t threadId;
+		std::atomic<uint64_t> head; // number of events ever written
+		CPUProfileEvent events[EVENTS_PER_THREAD];
+	};
+
+	static uint64_t nowNs();
+	static void record(const char* name, uint64_t startNs, uint64_t endNs);
+
+	// Writes every thread's recorded events as Chrome trace JSON; safe to call while other threads record
+	static bool writeChromeTrace(const char* path);
+
+private:
+	static ThreadBuffer* threadBuffer();
+};
+
+// Records the enclosing scope's duration under a name
+class CPUProfileScope
+{
+	const char* name;
+	uint64_t startNs;
+
+public:
+	explicit CPUProfileScope(const char* name) : name(name), startNs(CPUProfiler::nowNs()) {}
+	~CPUProfileScope() { CPUProfiler::record(name, startNs, CPUProfiler::nowNs()); }
+};
+
+#define CPU_PROFILE_CONCAT_INNER(a, b) a##b
+#define CPU_PROFILE_CONCAT(a, b) CPU_PROFILE_CONCAT_INNER(a, b)
+
+#ifndef CPU_PROFILER_DISABLED
+#define CPU_PROFILE_SCOPE(name) CPUProfileScope CPU_PROFILE_CONCAT(cpuProfileScope, __LINE__)(name)
+#else
+#define CPU_PROFILE_SCOPE(name) ((void)0)
+#endif
+#define CPU_PROFILE_FUNCTION() CPU_PROFILE_SCOPE(__FUNCTION__)
@@ -5,10 +5,24 @@
 
 #include <iostream>         // cout, cerr
 #include <cstdlib>          // EXIT_FAILURE
+#include <cstdio>           // fopen, fprintf
+#include <cstring>          // strcmp, strchr
+#include <cstddef>          // offsetof
+#include <map>              // Mesh cache lookup
+#include <utility>          // pair
+#include <vector>           // Mesh cache storage
+#include <algorithm>        // sort
+#include <string>           // Output file names
+#include <thread>           // hardware_concurrency
 #include <GL/glew.h>        // GLEW library
 #include <GLFW/glfw3.h>     // GLFW library
 
 #define STB_IMAGE_IMPLEMENTATION
+// stb_image's working memory comes from the decoding thread's arena while a DecodeArena::Scope is open
+#include "DecodeArena.h"
+#define STBI_MALLOC(size) DecodeArena::allocate(size)
+#define STBI_REALLOC_SIZED(p, oldSize, newSize) DecodeArena::reallocate(p, oldSize, newSize)
+#define STBI_FREE(p) DecodeArena::release(p)
 
 // GLM Math Header inclusions
 #include <glm/glm.hpp>
@@ -19,6 +33,20 @@
 #include "ShapeGenerator.h"
 #include "ShapeData.h"
 
+// Draw sorting and submission, GL state mirror
+#include "RenderQueue.h"
+#include "GLStateCache.h"
+#include "FrustumCuller.h"
+#include "NormalMatrix.h"
+#include "CameraPath.h"
+#include "GPUProfiler.h"
+#include "CPUProfiler.h"
+#include "FrameStats.h"
+#include "TextureLoader.h"
+#include "TextureCache.h"
+#include "AssetPack.h"
+#include "FileUtils.h"
+
 // Header inclusions for camera and images
 #include "camera.h"        // Camera class (taken from learnopengl)
 #include "stb_image.h"     // Image loading Utility functions
@@ -39,33 +67,253 @@ namespace
     const int WINDOW_WIDTH = 800;
     const int WINDOW_HEIGHT = 600;
 
-    // Stores the GL data relative to a given mesh
+    // Near and far clipping distances of the projection
+    const float Z_NEAR = 0.1f;
+    const float Z_FAR = 100.0f;
+
+    // Kinds of generated shapes that can be cached on the GPU
+    enum ShapeKind
+    {
+        SHAPE_PLANE,
+        SHAPE_SPHERE
+    };
+
+    // Vertex format shared by every static mesh
+    struct MeshVertex
+    {
+        glm::vec3 position;
+        glm::vec3 normal;
+        glm::vec2 textureCoordinate;
+    };
+
+    // Range of one mesh inside the shared vertex and index buffers
+    struct MeshRange
+    {
+        GLuint firstIndex;
+        GLuint nIndices;
+        GLint baseVertex;
+    };
+
+    // Stores the GL data of every static mesh: one vertex buffer and one index buffer shared by all meshes
     struct GLMesh
     {
-        GLuint containerVao;         // Handles for the vertex array objects
-        GLuint planeVao;
-        GLuint lampVao;
-        GLuint bookVao;
+        GLuint vao;                  // Shared vertex format plus the per-instance attributes
+        GLuint vbo;                  // Vertices of every mesh
+        GLuint ibo;                  // Indices of every mesh, relative to the mesh's base vertex
+        GLuint instanceVbo;          // Per-frame instance data
+        GLuint commandBuffer;        // Per-frame indirect draw commands
+
+        GLuint nVertices;            // Vertices and indices already on the GPU
+        GLuint nIndices;
 
-        GLuint containerVbo;         // Handles for the vertex buffer objects
-        GLuint planeVbo;
-        GLuint lampVbo;
-        GLuint bookVbo;
+        // Meshes added since the last upload
+        std::vector<MeshVertex> pendingVertices;
+        std::vector<GLuint> pendingIndices;
 
-        GLuint nContainerVertices;    // Number of indices of the meshes
-        GLuint nPlaneVertices;
-        GLuint nLampVertices;
-        GLuint nBookVertices;
+        std::vector<MeshRange> ranges; // Indexed by mesh handle
+        std::vector<BoundingVolume> bounds; // Object-space bounds, indexed by mesh handle
 
+        GLuint container;            // Handles of the hand-authored meshes
+        GLuint plane;
+        GLuint lamp;
+        GLuint book;
+
+        // Generated shapes, built once and looked up by (shape kind, tessellation)
+        std::map<std::pair<int, uint>, GLuint> shapeHandles;
+
+        GLuint sphereHandle;          // Handle of the sphere
+    };
+
+    // Tessellation of the sphere mesh
+    const uint SPHERE_TESSELATION = 20;
+
+    // "meshes/table" entry of an asset pack: the named mesh handles, then the range and bounds of every
+    // handle. Packs hold MeshVertex and these records as laid out in memory; UPackContentsVersion covers
+    // their sizes and offsets, so a pack written before they change is refused. Bump PACK_LAYOUT_VERSION
+    // for changes those miss, such as swapping two fields of the same type.
+    const uint64_t PACK_LAYOUT_VERSION = 1;
+    struct PackedMeshTable
+    {
+        GLuint container;
+        GLuint plane;
+        GLuint lamp;
+        GLuint book;
+        GLuint sphere;
+        GLuint sphereTesselation;
+        GLuint nMeshes;
+    };
+    struct PackedMesh
+    {
+        MeshRange range;
+        BoundingVolume bounds;
+    };
+
+
+    // Uniforms used by the render functions, indexes into ShaderProgram::uniforms
+    enum UniformId
+    {
+        UNIFORM_OBJECT_COLOR,
+        UNIFORM_TEXTURE,
+        UNIFORM_UV_SCALE,
+        UNIFORM_COUNT
+    };
+
+    // GLSL names of the uniforms above, in the same order
+    const char* const UNIFORM_NAMES[UNIFORM_COUNT] =
+    {
+        "objectColor",
+        "uTexture",
+        "uvScale"
+    };
+
+    // Linked shader program and its uniform locations (-1 when the program does not use it)
+    struct ShaderProgram
+    {
+        GLuint id;
+        GLint uniforms[UNIFORM_COUNT];
+    };
+
+
+    // Surface settings of a lit object, fed to the lit shader program through the material buffer
+    struct Material
+    {
+        GLuint texture;
+        float ambientStrength;
+        float specularStrength;
+        glm::vec2 uvScale;           // Texture tiling, combined with the user-controlled gUVScale
+    };
+
+    // Slots of the materials inside the material buffer
+    enum MaterialSlot
+    {
+        MATERIAL_CONTAINER,
+        MATERIAL_PLANE,
+        MATERIAL_BOOK,
+        MATERIAL_COUNT
+    };
+
+    // Mirrors one std430 MaterialData entry of the Materials shader storage buffer
+    struct MaterialData
+    {
+        float ambientStrength;
+        float specularStrength;
+        glm::vec2 uvScale;
+    };
+
+    // Binding point of the Materials shader storage buffer
+    const GLuint MATERIAL_BUFFER_BINDING = 1;
+
+    // Per-instance vertex data (attributes 3 to 10)
+    struct InstanceData
+    {
+        glm::mat4 model;
+        glm::mat3 normalMatrix;      // Inverse transpose of the model's upper 3x3, filled in by UQueueMeshDraws
+        GLuint materialIndex;        // MaterialSlot of the instance
+        GLuint padding[2];
+    };
+
+    // Sets of draws sharing a program and texture, each submitted with one multi-draw-indirect call
+    enum DrawGroupId
+    {
+        GROUP_CONTAINER,
+        GROUP_PLANE,
+        GROUP_BOOK,
+        GROUP_LAMP,
+        GROUP_COUNT
+    };
+
+    struct DrawGroup
+    {
+        RenderPass pass;
+        const ShaderProgram* program;
+        GLuint texture;
+        void (*bindMaterial)(const void* group);
+        const char* name;            // GPU profiler section
+    };
+
+    // One mesh instance to draw this frame
+    struct MeshDraw
+    {
+        GLuint group;                // DrawGroupId
+        GLuint mesh;                 // Mesh handle
+        InstanceData instance;
+    };
+
+    // Layout of one GL_DRAW_INDIRECT_BUFFER entry read by glMultiDrawElementsIndirect
+    struct DrawElementsIndirectCommand
+    {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+    // Mirrors the std140 FrameData uniform block shared by every shader
+    struct FrameUniforms
+    {
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::vec4 lightColor;        // xyz used, w is std140 padding
+        glm::vec4 lightPos;
+        glm::vec4 viewPosition;
+    };
+
+    // Binding point of the FrameData uniform block
+    const GLuint FRAME_UNIFORM_BINDING = 0;
+
+    // Camera state computed once at the top of every frame and handed to the render functions
+    struct FrameContext
+    {
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::mat4 viewProjection;
+        glm::vec3 cameraPosition;
+        Frustum frustum;
     };
 
 
     // Main GLFW window
     GLFWwindow* gWindow = nullptr;
 
+    // --headless: render offscreen into gOffscreen for a fixed number of frames, then report frame times
+    bool gHeadless = false;
+    unsigned long long gHeadlessFrames = 1000; // --frames N
+    struct OffscreenTarget
+    {
+        GLuint fbo;
+        GLuint colorRbo;
+        GLuint depthRbo;
+    };
+    OffscreenTarget gOffscreen;
+
+    // Wall-clock time of every frame in milliseconds, kept only for --frame-times FILE (CSV)
+    std::vector<double> gFrameTimes;
+    const char* gFrameTimesPath = nullptr;
+
+    // CPU, GPU and total frame time histograms, reported at exit. --frame-stats PREFIX also writes
+    // PREFIX.csv (histograms) and PREFIX.json (percentiles, stalls) every FRAME_STATS_INTERVAL seconds and at exit
+    FrameStats gFrameStats;
+    const char* gFrameStatsPrefix = nullptr;
+    const double FRAME_STATS_INTERVAL = 10.0;
+
+    // --record FILE saves the camera pose of every frame; --replay FILE drives the camera from such a file
+    // at a fixed time step instead of live input, and ends the run when the path ends
+    const float REPLAY_TIME_STEP = 1.0f / 60.0f;
+    const char* gRecordPath = nullptr;
+    const char* gReplayPath = nullptr;
+    CameraPath gCameraPath;
+    double gRecordStart = 0.0;
+
     // Triangle mesh data
     GLMesh gMesh;
 
+    // Texture images, found in the asset pack under these names when one is open
+    const char* const TEXTURE_CONTAINER = "Debug/resources/ContainerTexture.jpg";
+    const char* const TEXTURE_PLANE = "Debug/resources/TableTexture.jpg";
+    const char* const TEXTURE_BOOK = "Debug/resources/PlannerTexture.jpg";
+    const char* const TEXTURE_SPHERE = "Debug/resources/TableTexture.jpg";
+
     // Texture id
     GLuint gTextureContainer;
     GLuint gTexturePlane;
@@ -73,14 +321,64 @@ namespace
     GLuint gTextureSphere;
     GLuint gTextureBook;
 
+    // Decodes texture files on worker threads and uploads them between frames
+    TextureLoader gTextureLoader;
+    // Shares one texture between every load of the same file or image
+    TextureCache gTextureCache(gTextureLoader);
+
+    // --pack FILE: meshes, shader sources and textures come from this memory-mapped asset pack, uploaded
+    // straight from the mapping; anything the pack lacks is loaded as usual. --write-pack FILE writes one.
+    AssetPack gAssetPack;
+    const char* gPackPath = nullptr;
+    const char* gWritePackPath = nullptr;
+
+    // Materials of the lit objects (textures are assigned once they are loaded)
+    Material gContainerMaterial = { 0, 0.75f, 1.0f, glm::vec2(1.0f, 1.0f) };
+    Material gPlaneMaterial = { 0, 0.75f, 1.0f, glm::vec2(1.0f, 1.0f) };
+    Material gBookMaterial = { 0, 0.75f, 1.0f, glm::vec2(1.0f, 1.0f) };
+
     glm::vec2 gUVScale(1.0f, 1.0f);
     GLint gTexWrapMode = GL_CLAMP_TO_BORDER;
 
     // Shader program
-    GLuint gContainerProgramId;
-    GLuint gPlaneProgramId;
-    GLuint gLampProgramId;
-    GLuint gBookProgramId;
+    ShaderProgram gLitProgram;       // Phong program shared by every textured object
+    ShaderProgram gLampProgram;
+
+    // Material table read by the lit program
+    GLuint gMaterialSsbo;
+
+    // Program and texture of each draw group, and this frame's mesh instances
+    DrawGroup gDrawGroups[GROUP_COUNT];
+    std::vector<MeshDraw> gMeshDraws;
+
+    // Instance data and indirect commands built from gMeshDraws every frame
+    std::vector<InstanceData> gFrameInstances;
+    std::vector<DrawElementsIndirectCommand> gFrameCommands;
+
+    // Per-frame uniform buffer (camera and light state)
+    GLuint gFrameUbo;
+
+    // Draws of the current frame, sorted by GL state before submission
+    RenderQueue gRenderQueue;
+
+    // Mirror of the GL bindings used every frame, with totals of its per-frame counters
+    GLStateCache gGLState;
+    unsigned long long gStateCallsIssued = 0;
+    unsigned long long gStateCallsElided = 0;
+    unsigned long long gFrameCount = 0;
+
+    // CPU trace, written on F12 and at exit when --cpu-trace FILE is given
+    const char* gCPUTracePath = nullptr;
+    const char* const DEFAULT_CPU_TRACE_PATH = "cpu_trace.json";
+
+    // GPU time of each render pass, written to --gpu-profile FILE as JSON at exit
+    GPUProfiler gGPUProfiler;
+    const char* gGPUProfilePath = nullptr;
+
+    // Rejects mesh instances outside the view frustum, with totals of its per-frame stats
+    FrustumCuller gCuller;
+    unsigned long long gObjectsTested = 0;
+    unsigned long long gObjectsCulled = 0;
 
     // camera
     Camera gCamera(glm::vec3(-1.5f, 2.0f, 8.0f));
@@ -92,11 +390,6 @@ namespace
     float gDeltaTime = 0.0f; // time between current frame and last frame
     float gLastFrame = 0.0f;
 
-    // offset variables for sphere
-    const uint NUM_VERTICES_PER_TRI = 3;
-    const uint NUM_FLOATS_PER_VERTICE = 9;
-    const uint VERTEX_BYTE_SIZE = NUM_FLOATS_PER_VERTICE * sizeof(float);
-
 
     // Object and light color
     glm::vec3 gObjectColor(1.f, 0.2f, 0.0f);
@@ -135,6 +428,15 @@ namespace
  */
 bool UInitialize(int, char* [], GLFWwindow** window);
 void UResizeWindow(GLFWwindow* window, int width, int height);
+//Headless rendering
+bool UCreateOffscreenTarget(OffscreenTarget& target, int width, int height);
+void UDestroyOffscreenTarget(OffscreenTarget& target);
+void UWriteFrameStats();
+bool UWriteFrameTimes(const char* filename, const std::vector<double>& frameTimes);
+void UWriteCPUTrace();
+//Camera path recording and replay
+bool UKeepRunning();
+void UApplyCameraPose(const CameraPose& pose);
 //Input Processing
 void UProcessInput(GLFWwindow* window);
 void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos);
@@ -145,161 +447,143 @@ void containerMesh(GLMesh& mesh);
 void planeMesh(GLMesh& mesh);
 void lampMesh(GLMesh& mesh);
 void bookMesh(GLMesh& mesh);
+GLuint UAddTriangleList(GLMesh& mesh, const GLfloat* vertexData, GLuint nFloats);
+GLuint UGetShapeMesh(GLMesh& mesh, ShapeKind kind, uint tesselation);
+void UBuildMeshes(GLMesh& mesh);
+void UGrowBuffer(GLuint& buffer, GLsizeiptr usedSize, GLsizeiptr newSize);
+void UAppendMeshData(GLMesh& mesh, const MeshVertex* vertices, GLuint nVertices, const GLuint* indices, GLuint nIndices);
+void UUploadMeshes(GLMesh& mesh);
 void UDestroyMesh(GLMesh& mesh);
 //Texture Handling
-bool UCreateTexture(const char* filename, GLuint& textureId);
-void UDestroyTexture(GLuint textureId);
+GLuint UAcquireTexture(const char* source);
+//Asset pack
+bool UWriteAssetPack(const char* path);
+uint64_t UPackContentsVersion();
+bool UPackTexture(AssetPackWriter& writer, const char* source);
+bool ULoadPackedMeshes(GLMesh& mesh, const AssetPack& pack);
+const char* UShaderSource(const char* name, const char* builtIn);
 //Rendering Functions
+glm::mat4 ULampModel();
+//Indirect multi-draw of the shared mesh buffers
+void UCreateMaterialBuffer(GLuint& ssbo);
+void UDestroyMaterialBuffer(GLuint ssbo);
+void UAddMeshDraw(DrawGroupId group, GLuint mesh, const glm::mat4& model, GLuint materialIndex);
+bool UCompareMeshDraws(const MeshDraw& a, const MeshDraw& b);
+void UCullMeshDraws(const FrameContext& frame);
+void UQueueMeshDraws(const FrameContext& frame);
+void UBindLitGroup(const void* group);
 void URenderContainer();
 void URenderPlane();
 void URenderLamp();
 void URenderSphere();
 void URenderBook();
+//Per-frame uniform buffer
+void UCreateFrameUniforms(GLuint& ubo);
+void UBuildFrameContext(FrameContext& frame);
+void UUpdateFrameUniforms(GLuint ubo, const FrameContext& frame);
+void UDestroyFrameUniforms(GLuint ubo);
 //Shader Program Handling
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
-void UDestroyShaderProgram(GLuint programId);
+bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, ShaderProgram& program);
+void UDestroyShaderProgram(ShaderProgram& program);
 //Orthographic function: Default FALSE
 bool orthoView = false;
 
 
 //----------------------------------------------
-/* Vertex Shader Source Code for CONTAINER */
+/* Vertex Shader Source Code for LIT objects, one instance per indirect draw command */
 //-----------------------------------------------
-const GLchar* containerVertexShaderSource = GLSL(440,
+const GLchar* litVertexShaderSource = GLSL(440,
     layout(location = 0) in vec3 position;
     layout(location = 1) in vec3 normal; // VAP position 1 for normals
     layout(location = 2) in vec2 textureCoordinate;
+    layout(location = 3) in mat4 instanceModel; // Per-instance model matrix (locations 3 to 6)
+    layout(location = 7) in uint instanceMaterial; // Per-instance index into the Materials buffer
+    layout(location = 8) in mat3 instanceNormalMatrix; // Per-instance normal matrix, built on the CPU (locations 8 to 10)
 
     out vec3 vertexNormal; // For outgoing normals to fragment shader
     out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
     out vec2 vertexTextureCoordinate;
+    flat out float vertexAmbientStrength; // Material of the instance for the fragment shader
+    flat out float vertexSpecularStrength;
 
 
-//Global variables for the transform matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-
-
-
-void main()
+// Camera and light state shared by every shader, written once per frame
+layout(std140, binding = 0) uniform FrameData
 {
-    gl_Position = projection * view * model * vec4(position, 1.0f); // transforms vertices to clip coordinates
-
-    vertexFragmentPos = vec3(model * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
-
-    vertexNormal = mat3(transpose(inverse(model))) * normal; // get normal vectors in world space only and exclude normal translation properties
-
-    vertexTextureCoordinate = textureCoordinate;
-}
-);
-
-/* Fragment Shader Source Code for CONTAINER*/
-//----------------------------------------------
-const GLchar* containerFragmentShaderSource = GLSL(440,
-    in vec3 vertexNormal; // For incoming normals
-    in vec3 vertexFragmentPos; // For incoming fragment position
-    in vec2 vertexTextureCoordinate;
-
-    out vec4 fragmentColor;
-
-    // Uniform / Global variables for object color, light color, light position, and camera/view position
-    uniform vec3 objectColor;
-    uniform vec3 lightColor;
-    uniform vec3 lightPos;
-    uniform vec3 viewPosition;
-    uniform sampler2D uTexture; // Useful when working with multiple textures
-    uniform vec2 uvScale;
-
-
-
-void main()
+    mat4 view;
+    mat4 projection;
+    vec3 lightColor;
+    vec3 lightPos;
+    vec3 viewPosition;
+};
+
+// Material table shared by every lit draw, indexed by instanceMaterial
+struct MaterialData
 {
-    /*Phong lighting model calculations to generate ambient, diffuse, and specular components*/
-
-    //Calculate Ambient lighting*/
-    float ambientStrength = 0.75f; // Set ambient or global lighting strength
-    vec3 ambient = ambientStrength * lightColor; // Generate ambient light color
-
-    //Calculate Diffuse lighting*/
-    vec3 norm = normalize(vertexNormal); // Normalize vectors to 1 unit
-    vec3 lightDirection = normalize(lightPos - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels on cube
-    float impact = max(dot(norm, lightDirection), 0.0);// Calculate diffuse impact by generating dot product of normal and light
-    vec3 diffuse = impact * lightColor; // Generate diffuse light color
-
-    //Calculate Specular lighting*/
-    float specularIntensity = 1.0f; // Set specular light strength
-    float highlightSize = 32.0f; // Set specular highlight size
-    vec3 viewDir = normalize(viewPosition - vertexFragmentPos); // Calculate view direction
-    vec3 reflectDir = reflect(-lightDirection, norm);// Calculate reflection vector
-    //Calculate specular component
-    float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
-    vec3 specular = specularIntensity * specularComponent * lightColor;
-
-    // Texture holds the color to be used for all three components
-    vec4 textureColor = texture(uTexture, vertexTextureCoordinate * uvScale);
+    float ambientStrength;
+    float specularStrength;
+    vec2 uvScale;
+};
+layout(std430, binding = 1) readonly buffer Materials
+{
+    MaterialData materials[];
+};
 
-    // Calculate phong result
-    vec3 phong = (ambient + diffuse + specular) * textureColor.xyz;
+uniform vec2 uvScale; // User-controlled texture scale, applied on top of the material's
 
-    fragmentColor = vec4(phong, 1.0); // Send lighting results to GPU
-}
-);
 
-//-------------------------------------------
-/* Vertex Shader Source Code for PLANE */
-//-------------------------------------------
-const GLchar* planeVertexShaderSource = GLSL(440,
-    layout(location = 0) in vec3 position;
-    layout(location = 1) in vec3 normal; // VAP position 1 for normals
-    layout(location = 2) in vec2 textureCoordinate;
-
-    out vec3 vertexNormal; // For outgoing normals to fragment shader
-    out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
-    out vec2 vertexTextureCoordinate;
-
-
-    //Global variables for the transform matrices
-    uniform mat4 model;
-    uniform mat4 view;
-    uniform mat4 projection;
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(position, 1.0f); // transforms vertices to clip coordinates
+    gl_Position = projection * view * instanceModel * vec4(position, 1.0f); // transforms vertices to clip coordinates
 
-    vertexFragmentPos = vec3(model * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
+    vertexFragmentPos = vec3(instanceModel * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
 
-    vertexNormal = mat3(transpose(inverse(model))) * normal; // get normal vectors in world space only and exclude normal translation properties
+    vertexNormal = instanceNormalMatrix * normal; // get normal vectors in world space only and exclude normal translation properties
 
-    vertexTextureCoordinate = textureCoordinate;
+    MaterialData material = materials[instanceMaterial];
+    // Textures are uploaded top row first, as decoded, so v is flipped here. Flipping after scaling
+    // keeps the tiling anchored at the bottom edge whatever the scale.
+    vertexTextureCoordinate = textureCoordinate * material.uvScale * uvScale;
+    vertexTextureCoordinate.y = 1.0 - vertexTextureCoordinate.y;
+    vertexAmbientStrength = material.ambientStrength;
+    vertexSpecularStrength = material.specularStrength;
 }
 );
 
-/* Fragment Shader Source Code for PLANE*/
+/* Fragment Shader Source Code for LIT objects, driven by the object's material*/
 //----------------------------------------------
-const GLchar* planeFragmentShaderSource = GLSL(440,
+const GLchar* litFragmentShaderSource = GLSL(440,
     in vec3 vertexNormal; // For incoming normals
     in vec3 vertexFragmentPos; // For incoming fragment position
-    in vec2 vertexTextureCoordinate;
+    in vec2 vertexTextureCoordinate; // Already scaled by the material's uvScale
+    flat in float vertexAmbientStrength; // Ambient or global lighting strength of the material
+    flat in float vertexSpecularStrength; // Specular light strength of the material
 
     out vec4 fragmentColor;
 
+// Camera and light state shared by every shader, written once per frame
+layout(std140, binding = 0) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec3 lightColor;
+    vec3 lightPos;
+    vec3 viewPosition;
+};
+
 // Uniform / Global variables for object color, light color, light position, and camera/view position
-uniform vec3 objectColor;
-uniform vec3 lightColor;
-uniform vec3 lightPos;
-uniform vec3 viewPosition;
-uniform sampler2D uTexture; // Useful when working with multiple textures
-uniform vec2 uvScale;
+    uniform vec3 objectColor;
+    uniform sampler2D uTexture; // Useful when working with multiple textures
+
+
 
 void main()
 {
     /*Phong lighting model calculations to generate ambient, diffuse, and specular components*/
 
     //Calculate Ambient lighting*/
-    float ambientStrength = 0.75f; // Set ambient or global lighting strength
-    vec3 ambient = ambientStrength * lightColor; // Generate ambient light color
+    vec3 ambient = vertexAmbientStrength * lightColor; // Generate ambient light color
 
     //Calculate Diffuse lighting*/
     vec3 norm = normalize(vertexNormal); // Normalize vectors to 1 unit
@@ -308,16 +592,15 @@ void main()
     vec3 diffuse = impact * lightColor; // Generate diffuse light color
 
     //Calculate Specular lighting*/
-    float specularIntensity = 1.0f; // Set specular light strength
     float highlightSize = 32.0f; // Set specular highlight size
     vec3 viewDir = normalize(viewPosition - vertexFragmentPos); // Calculate view direction
     vec3 reflectDir = reflect(-lightDirection, norm);// Calculate reflection vector
     //Calculate specular component
     float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
-    vec3 specular = specularIntensity * specularComponent * lightColor;
+    vec3 specular = vertexSpecularStrength * specularComponent * lightColor;
 
     // Texture holds the color to be used for all three components
-    vec4 textureColor = texture(uTexture, vertexTextureCoordinate * uvScale);
+    vec4 textureColor = texture(uTexture, vertexTextureCoordinate);
 
     // Calculate phong result
     vec3 phong = (ambient + diffuse + specular) * textureColor.xyz;
@@ -326,22 +609,27 @@ void main()
 }
 );
 
-
 //-------------------------------------------
 /* Vertex Shader Source Code for LAMP */
 //-------------------------------------------
 const GLchar* lampVertexShaderSource = GLSL(440,
     layout(location = 0) in vec3 position;
+    layout(location = 3) in mat4 instanceModel; // Per-instance model matrix (locations 3 to 6)
 
 
-//Global variables for the transform matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Camera and light state shared by every shader, written once per frame
+layout(std140, binding = 0) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec3 lightColor;
+    vec3 lightPos;
+    vec3 viewPosition;
+};
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(position, 1.0f); // transforms vertices to clip coordinates
+    gl_Position = projection * view * instanceModel * vec4(position, 1.0f); // transforms vertices to clip coordinates
 
 }
 );
@@ -360,253 +648,318 @@ void main()
 );
 
 
-//-------------------------------------------
-/* Vertex Shader Source Code for BOOK */
-//-------------------------------------------
-const GLchar* bookVertexShaderSource = GLSL(440,
-    layout(location = 0) in vec3 position;
-layout(location = 1) in vec3 normal; // VAP position 1 for normals
-layout(location = 2) in vec2 textureCoordinate;
-
-out vec3 vertexNormal; // For outgoing normals to fragment shader
-out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
-out vec2 vertexTextureCoordinate;
-
-
-//Global variables for the transform matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-
-
-
-void main()
-{
-    gl_Position = projection * view * model * vec4(position, 1.0f); // transforms vertices to clip coordinates
-
-    vertexFragmentPos = vec3(model * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
-
-    vertexNormal = mat3(transpose(inverse(model))) * normal; // get normal vectors in world space only and exclude normal translation properties
-
-    vertexTextureCoordinate = textureCoordinate;
-}
-);
-
-
-/* Fragment Shader Source Code for BOOK*/
-//----------------------------------------------
-const GLchar* bookFragmentShaderSource = GLSL(440,
-    in vec3 vertexNormal; // For incoming normals
-    in vec3 vertexFragmentPos; // For incoming fragment position
-    in vec2 vertexTextureCoordinate;
-
-    out vec4 fragmentColor;
-
-// Uniform / Global variables for object color, light color, light position, and camera/view position
-uniform vec3 objectColor;
-uniform vec3 lightColor;
-uniform vec3 lightPos;
-uniform vec3 viewPosition;
-uniform sampler2D uTexture; // Useful when working with multiple textures
-uniform vec2 uvScale;
-
-
-
-void main()
-{
-    /*Phong lighting model calculations to generate ambient, diffuse, and specular components*/
-
-    //Calculate Ambient lighting*/
-    float ambientStrength = 0.75f; // Set ambient or global lighting strength
-    vec3 ambient = ambientStrength * lightColor; // Generate ambient light color
-
-    //Calculate Diffuse lighting*/
-    vec3 norm = normalize(vertexNormal); // Normalize vectors to 1 unit
-    vec3 lightDirection = normalize(lightPos - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels on cube
-    float impact = max(dot(norm, lightDirection), 0.0);// Calculate diffuse impact by generating dot product of normal and light
-    vec3 diffuse = impact * lightColor; // Generate diffuse light color
-
-    //Calculate Specular lighting*/
-    float specularIntensity = 1.0f; // Set specular light strength
-    float highlightSize = 32.0f; // Set specular highlight size
-    vec3 viewDir = normalize(viewPosition - vertexFragmentPos); // Calculate view direction
-    vec3 reflectDir = reflect(-lightDirection, norm);// Calculate reflection vector
-    //Calculate specular component
-    float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
-    vec3 specular = specularIntensity * specularComponent * lightColor;
-
-    // Texture holds the color to be used for all three components
-    vec4 textureColor = texture(uTexture, vertexTextureCoordinate * uvScale);
-
-    // Calculate phong result
-    vec3 phong = (ambient + diffuse + specular) * textureColor.xyz;
-
-    fragmentColor = vec4(phong, 1.0); // Send lighting results to GPU
-}
-);
-
-
-// Images are loaded with Y axis going down, but OpenGL's Y axis goes up, so let's flip it
-void flipImageVertically(unsigned char* image, int width, int height, int channels)
-{
-    for (int j = 0; j < height / 2; ++j)
-    {
-        int index1 = j * width * channels;
-        int index2 = (height - 1 - j) * width * channels;
-
-        for (int i = width * channels; i > 0; --i)
-        {
-            unsigned char tmp = image[index1];
-            image[index1] = image[index2];
-            image[index2] = tmp;
-            ++index1;
-            ++index2;
-        }
-    }
-}
-
-
 int main(int argc, char* argv[])
 {
     if (!UInitialize(argc, argv, &gWindow))
         return EXIT_FAILURE;
 
-    // Create the meshes
-    containerMesh(gMesh); // Calls the function to create the Vertex Buffer Object
-    planeMesh(gMesh);
-    lampMesh(gMesh);
-    bookMesh(gMesh);
+    // Packing needs no window: write the pack and stop
+    if (gWritePackPath)
+        return UWriteAssetPack(gWritePackPath) ? EXIT_SUCCESS : EXIT_FAILURE;
 
-    // Create the shader programs
-    if (!UCreateShaderProgram(containerVertexShaderSource, containerFragmentShaderSource, gContainerProgramId))
+    if (gPackPath && !gAssetPack.open(gPackPath, UPackContentsVersion()))
     {
+        cout << "Failed to open asset pack " << gPackPath << endl;
         return EXIT_FAILURE;
     }
 
-    if (!UCreateShaderProgram(planeVertexShaderSource, planeFragmentShaderSource, gPlaneProgramId))
+    // Start decoding the textures first so the workers overlap mesh and shader setup;
+    // the names hold placeholders until the loader swaps in the images
+    gTextureContainer = UAcquireTexture(TEXTURE_CONTAINER);
+    gTexturePlane = UAcquireTexture(TEXTURE_PLANE);
+    gTextureSphere = UAcquireTexture(TEXTURE_SPHERE);
+    gTextureBook = UAcquireTexture(TEXTURE_BOOK);
+    if (!gTextureContainer || !gTexturePlane || !gTextureSphere || !gTextureBook)
     {
+        cout << "Failed to load textures" << endl;
         return EXIT_FAILURE;
     }
 
-    if (!UCreateShaderProgram(lampVertexShaderSource, lampFragmentShaderSource, gLampProgramId))
+    // Create the meshes, from the asset pack's buffers when it has them
+    if (!gAssetPack.isOpen() || !ULoadPackedMeshes(gMesh, gAssetPack))
     {
-        return EXIT_FAILURE;
+        UBuildMeshes(gMesh);
+        UUploadMeshes(gMesh);
     }
 
-    if (!UCreateShaderProgram(bookVertexShaderSource, bookFragmentShaderSource, gBookProgramId))
+    // Create the shader programs
+    if (!UCreateShaderProgram(UShaderSource("shaders/lit.vert", litVertexShaderSource), UShaderSource("shaders/lit.frag", litFragmentShaderSource), gLitProgram))
     {
         return EXIT_FAILURE;
     }
 
-
-    // Load texture
-    const char* texContainer = "Debug/resources/ContainerTexture.jpg";
-    const char* texPlane = "Debug/resources/TableTexture.jpg";
-    const char* texBook = "Debug/resources/PlannerTexture.jpg";
-    const char* texSphere = "Debug/resources/TableTexture.jpg";
-    
-
-    if (!UCreateTexture(texContainer, gTextureContainer))
+    if (!UCreateShaderProgram(UShaderSource("shaders/lamp.vert", lampVertexShaderSource), UShaderSource("shaders/lamp.frag", lampFragmentShaderSource), gLampProgram))
     {
-        cout << "Failed to load texture " << texContainer << endl;
         return EXIT_FAILURE;
     }
 
-    if (!UCreateTexture(texPlane, gTexturePlane))
+
+    // Materials of the lit objects
+    gContainerMaterial.texture = gTextureContainer;
+    gPlaneMaterial.texture = gTexturePlane;
+    gBookMaterial.texture = gTextureBook;
+    UCreateMaterialBuffer(gMaterialSsbo);
+
+    // Draw groups, each submitted as one multi-draw per frame
+    DrawGroup containerGroup = { PASS_OPAQUE, &gLitProgram, gContainerMaterial.texture, UBindLitGroup, "Containers" };
+    DrawGroup planeGroup = { PASS_OPAQUE, &gLitProgram, gPlaneMaterial.texture, UBindLitGroup, "Plane" };
+    DrawGroup bookGroup = { PASS_OPAQUE, &gLitProgram, gBookMaterial.texture, UBindLitGroup, "Books" };
+    DrawGroup lampGroup = { PASS_OPAQUE, &gLampProgram, 0, NULL, "Lamp and sphere" };
+    gDrawGroups[GROUP_CONTAINER] = containerGroup;
+    gDrawGroups[GROUP_PLANE] = planeGroup;
+    gDrawGroups[GROUP_BOOK] = bookGroup;
+    gDrawGroups[GROUP_LAMP] = lampGroup;
+
+    // Create the per-frame uniform buffer read by every shader
+    UCreateFrameUniforms(gFrameUbo);
+
+    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
+    glUseProgram(gLitProgram.id);
+    // We set the texture as texture unit 0
+    glUniform1i(gLitProgram.uniforms[UNIFORM_TEXTURE], 0);
+
+    // Replays need their whole path before the first frame
+    if (gReplayPath && !gCameraPath.load(gReplayPath))
     {
-        cout << "Failed to load texture " << texPlane << endl;
+        cout << "Failed to load camera path " << gReplayPath << endl;
         return EXIT_FAILURE;
     }
 
-    if (!UCreateTexture(texSphere, gTextureSphere))
+    // Headless runs have no default framebuffer to draw into
+    if (gHeadless && !UCreateOffscreenTarget(gOffscreen, WINDOW_WIDTH, WINDOW_HEIGHT))
     {
-        cout << "Failed to load texture " << texBook << endl;
         return EXIT_FAILURE;
     }
 
-    if (!UCreateTexture(texBook, gTextureBook))
+    // Benchmarks must not time frames drawn with placeholder textures
+    if (gHeadless || gReplayPath)
     {
-        cout << "Failed to load texture " << texBook << endl;
-        return EXIT_FAILURE;
+        gTextureLoader.finish(gGLState);
+        if (gTextureLoader.failed())
+            return EXIT_FAILURE;
     }
 
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gContainerProgramId);
-    // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gContainerProgramId, "uTexture"), 0);
-    
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gPlaneProgramId);
-    // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gPlaneProgramId, "uTexture"), 0);
-
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gLampProgramId);
-    // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gLampProgramId, "uTexture"), 0);
-
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gBookProgramId);
-    // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gBookProgramId, "uTexture"), 0);
+    // Startup code bound objects directly, so the state mirror starts from scratch
+    gGLState.invalidate();
 
 
     // render loop
     // -----------
-    while (!glfwWindowShouldClose(gWindow))
+    gRecordStart = glfwGetTime();
+    double lastStatsWrite = gRecordStart;
+    // A texture that can't be loaded ends the run, as it did when textures loaded before the first frame
+    while (UKeepRunning() && !gTextureLoader.failed())
     {
+        CPU_PROFILE_SCOPE("Frame");
+
         // per-frame timing
         // --------------------
+        double frameStart = glfwGetTime();
         float currentFrame = glfwGetTime();
-        gDeltaTime = currentFrame - gLastFrame;
+        gDeltaTime = gReplayPath ? REPLAY_TIME_STEP : currentFrame - gLastFrame;
         gLastFrame = currentFrame;
+        gGLState.resetCounters();
+        gGPUProfiler.beginFrame();
+        gGPUProfiler.begin("Frame");
+
+        // Enable z-depth
+        gGLState.enable(GL_DEPTH_TEST);
 
         // Clear the frame and z buffers
+        gGPUProfiler.begin("Clear");
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        gGPUProfiler.end();
 
         // input
         // -----
-        UProcessInput(gWindow);
+        if (gReplayPath)
+            UApplyCameraPose(gCameraPath.sample(gFrameCount * REPLAY_TIME_STEP));
+        else
+            UProcessInput(gWindow);
+
+        if (gRecordPath)
+            gCameraPath.record((float)(frameStart - gRecordStart), gCamera, orthoView);
+
+        // Camera matrices for this frame, computed once and shared by every render function
+        FrameContext frame;
+        UBuildFrameContext(frame);
+
+        // Upload camera and light state shared by all shaders
+        gGPUProfiler.begin("Uploads");
+        UUpdateFrameUniforms(gFrameUbo, frame);
+        gTextureLoader.update(gGLState);
+
+        // Queue this frame's objects, then sort them by GL state and draw them
+        {
+            CPU_PROFILE_SCOPE("Build draws");
+            gRenderQueue.clear();
+            gMeshDraws.clear();
+            URenderContainer();
+            URenderPlane();
+            URenderLamp();
+            URenderSphere();
+            URenderBook();
+
+            // Drop instances outside the view, then draw the rest from the shared buffers: one indirect multi-draw per group
+            UCullMeshDraws(frame);
+            UQueueMeshDraws(frame);
+        }
+        gGPUProfiler.end();
+
+        // Each draw group is timed as its own pass
+        {
+            CPU_PROFILE_SCOPE("Sort and submit");
+            gRenderQueue.sort();
+            gRenderQueue.submit(gGLState, &gGPUProfiler);
+        }
+        gGPUProfiler.end();
+        gGPUProfiler.endFrame();
+
+        // Accumulate this frame's issued and elided state calls
+        gStateCallsIssued += gGLState.getCounters().issued;
+        gStateCallsElided += gGLState.getCounters().elided;
+        gObjectsTested += gCuller.getStats().tested;
+        gObjectsCulled += gCuller.getStats().culled;
+        ++gFrameCount;
 
-        // Render this frame
-        URenderContainer();
-        URenderPlane();
-        URenderLamp();
-        URenderSphere();
-        URenderBook();
+        double cpuEnd = glfwGetTime();
 
-        glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
+        // Offscreen frames are never presented: wait for the GPU instead so the frame time includes its work
+        {
+            CPU_PROFILE_SCOPE(gHeadless ? "glFinish" : "Swap buffers");
+            if (gHeadless)
+                glFinish();
+            else
+                glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
+        }
 
         glfwPollEvents();
+
+        // Frame statistics; the GPU time of a frame arrives a few frames later from the timer queries
+        double frameEnd = glfwGetTime();
+        gFrameStats.recordFrame((cpuEnd - frameStart) * 1000.0, (frameEnd - frameStart) * 1000.0);
+        double gpuFrameMs;
+        if (gGPUProfiler.takeLatest("Frame", gpuFrameMs))
+            gFrameStats.recordGpu(gpuFrameMs);
+        if (gFrameTimesPath)
+            gFrameTimes.push_back((frameEnd - frameStart) * 1000.0);
+
+        if (gFrameStatsPrefix && frameEnd - lastStatsWrite >= FRAME_STATS_INTERVAL)
+        {
+            UWriteFrameStats();
+            lastStatsWrite = frameEnd;
+        }
+    }
+
+    // Report how many redundant state calls the state mirror dropped
+    if (gFrameCount > 0)
+    {
+        cout << "INFO: GL state calls per frame: " << (double)gStateCallsIssued / gFrameCount << " issued, "
+            << (double)gStateCallsElided / gFrameCount << " elided" << endl;
+        cout << "INFO: Objects per frame: " << (double)gObjectsTested / gFrameCount << " tested, "
+            << (double)gObjectsCulled / gFrameCount << " culled" << endl;
+        gFrameStats.print(cout);
     }
 
+    if (gFrameStatsPrefix)
+        UWriteFrameStats();
+
+    if (gCPUTracePath)
+        UWriteCPUTrace();
+
+    gGPUProfiler.print(cout);
+    if (gGPUProfilePath && !gGPUProfiler.writeJson(gGPUProfilePath))
+        cout << "Failed to write GPU profile to " << gGPUProfilePath << endl;
+    gGPUProfiler.destroy();
+
+    if (gFrameTimesPath && !UWriteFrameTimes(gFrameTimesPath, gFrameTimes))
+        cout << "Failed to write frame times to " << gFrameTimesPath << endl;
+
+    if (gRecordPath && !gCameraPath.save(gRecordPath))
+        cout << "Failed to save camera path " << gRecordPath << endl;
+
     // Release mesh data
     UDestroyMesh(gMesh);
 
     // Release texture
-    UDestroyTexture(gTextureContainer);
-    UDestroyTexture(gTexturePlane);
-    UDestroyTexture(gTextureLamp);
-    UDestroyTexture(gTextureSphere);
-    UDestroyTexture(gTextureBook);
+    gTextureCache.release(gTextureContainer, gGLState);
+    gTextureCache.release(gTexturePlane, gGLState);
+    gTextureCache.release(gTextureLamp, gGLState);
+    gTextureCache.release(gTextureSphere, gGLState);
+    gTextureCache.release(gTextureBook, gGLState);
+    gTextureLoader.shutdown();
+
+    // Nothing reads from the pack past this point
+    gAssetPack.close();
 
     // Release shader program
-    UDestroyShaderProgram(gContainerProgramId);
-    UDestroyShaderProgram(gPlaneProgramId);
-    UDestroyShaderProgram(gLampProgramId);
-    //UDestroyShaderProgram(gSphereProgramId);
-    UDestroyShaderProgram(gBookProgramId);
+    UDestroyShaderProgram(gLitProgram);
+    UDestroyShaderProgram(gLampProgram);
 
-    exit(EXIT_SUCCESS); // Terminates the program successfully
+    // Release material table
+    UDestroyMaterialBuffer(gMaterialSsbo);
+
+    // Release per-frame uniform buffer
+    UDestroyFrameUniforms(gFrameUbo);
+
+    if (gHeadless)
+        UDestroyOffscreenTarget(gOffscreen);
+
+    exit(gTextureLoader.failed() ? EXIT_FAILURE : EXIT_SUCCESS); // Terminates the program
 }
 
 
 // Initialize GLFW, GLEW, and create a window
 bool UInitialize(int argc, char* argv[], GLFWwindow** window)
 {
+    // Command line: --headless [--frames N] [--record FILE | --replay FILE]
+    //               [--frame-times FILE] [--frame-stats PREFIX] [--gpu-profile FILE] [--cpu-trace FILE]
+    //               [--pack FILE | --write-pack FILE]
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--headless") == 0)
+            gHeadless = true;
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            gHeadlessFrames = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            gRecordPath = argv[++i];
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+            gReplayPath = argv[++i];
+        else if (strcmp(argv[i], "--frame-times") == 0 && i + 1 < argc)
+            gFrameTimesPath = argv[++i];
+        else if (strcmp(argv[i], "--gpu-profile") == 0 && i + 1 < argc)
+            gGPUProfilePath = argv[++i];
+        else if (strcmp(argv[i], "--cpu-trace") == 0 && i + 1 < argc)
+            gCPUTracePath = argv[++i];
+        else if (strcmp(argv[i], "--frame-stats") == 0 && i + 1 < argc)
+            gFrameStatsPrefix = argv[++i];
+        else if (strcmp(argv[i], "--pack") == 0 && i + 1 < argc)
+            gPackPath = argv[++i];
+        else if (strcmp(argv[i], "--write-pack") == 0 && i + 1 < argc)
+            gWritePackPath = argv[++i];
+        else
+            cout << "WARNING: Ignoring unknown argument " << argv[i] << endl;
+    }
+
+    // Both would share gCameraPath, recording over the path being replayed
+    if (gRecordPath && gReplayPath)
+    {
+        cout << "--record and --replay can't be used together" << endl;
+        return false;
+    }
+
+    // Writing a pack only reads files, no window or GL context is needed
+    if (gWritePackPath)
+        return true;
+
     // GLFW: initialize and configure
     // ------------------------------
+#ifdef GLFW_PLATFORM_NULL
+    // GLFW 3.4+: the null platform needs no display server; its contexts come from EGL (surfaceless) or OSMesa
+    if (gHeadless)
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#endif
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
@@ -616,9 +969,22 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
 
+    // Headless: an invisible window only provides the context, rendering goes to an FBO
+    if (gHeadless)
+    {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+    }
+
     // GLFW: window creation
     // ---------------------
     * window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
+    if (*window == NULL && gHeadless)
+    {
+        // No usable EGL driver: fall back to Mesa's software OSMesa context (llvmpipe)
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+        *window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
+    }
     if (*window == NULL)
     {
         std::cout << "Failed to create GLFW window" << std::endl;
@@ -640,6 +1006,12 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
     glewExperimental = GL_TRUE;
     GLenum GlewInitResult = glewInit();
 
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    // GLEW built for GLX reports this for EGL and OSMesa contexts after the GL entry points are already loaded
+    if (gHeadless && GlewInitResult == GLEW_ERROR_NO_GLX_DISPLAY)
+        GlewInitResult = GLEW_OK;
+#endif
+
     if (GLEW_OK != GlewInitResult)
     {
         std::cerr << glewGetErrorString(GlewInitResult) << std::endl;
@@ -653,9 +1025,31 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
 }
 
 
+// Whether the render loop runs another frame: a fixed count when headless, the length of the path when
+// replaying, otherwise until the window is closed
+bool UKeepRunning()
+{
+    if (gHeadless && gFrameCount >= gHeadlessFrames)
+        return false;
+    if (gReplayPath && gFrameCount * REPLAY_TIME_STEP > gCameraPath.duration())
+        return false;
+    return gHeadless || !glfwWindowShouldClose(gWindow);
+}
+
+
+// Places the camera at a recorded pose, including the projection it was recorded with
+void UApplyCameraPose(const CameraPose& pose)
+{
+    orthoView = (pose.flags & CameraPose::ORTHOGRAPHIC) != 0;
+    gCamera.WorldUp = orthoView ? glm::vec3(0.0f, -1.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    gCamera.SetPose(pose.position, pose.yaw, pose.pitch, pose.zoom);
+}
+
+
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
 void UProcessInput(GLFWwindow* window)
 {
+    CPU_PROFILE_FUNCTION();
     static const float cameraSpeed = 2.5f;
 
     //To get Ortho view
@@ -701,6 +1095,12 @@ void UProcessInput(GLFWwindow* window)
         cout << "Current scale (" << gUVScale[0] << ", " << gUVScale[1] << ")" << endl;
     }
 
+    // F12 dumps the CPU trace recorded so far (once per press)
+    static bool traceKeyDown = false;
+    bool traceKeyPressed = glfwGetKey(window, GLFW_KEY_F12) == GLFW_PRESS;
+    if (traceKeyPressed && !traceKeyDown)
+        UWriteCPUTrace();
+    traceKeyDown = traceKeyPressed;
 }
 
 
@@ -711,10 +1111,85 @@ void UResizeWindow(GLFWwindow* window, int width, int height)
 }
 
 
+// Creates and binds the framebuffer headless runs render into, the same size as the window
+bool UCreateOffscreenTarget(OffscreenTarget& target, int width, int height)
+{
+    glGenFramebuffers(1, &target.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+
+    glGenRenderbuffers(1, &target.colorRbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, target.colorRbo);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.colorRbo);
+
+    glGenRenderbuffers(1, &target.depthRbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, target.depthRbo);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target.depthRbo);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        cout << "ERROR::FRAMEBUFFER::OFFSCREEN_TARGET_INCOMPLETE" << endl;
+        return false;
+    }
+
+    // A surfaceless context starts with an empty viewport
+    glViewport(0, 0, width, height);
+    return true;
+}
+
+
+void UDestroyOffscreenTarget(OffscreenTarget& target)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &target.fbo);
+    glDeleteRenderbuffers(1, &target.colorRbo);
+    glDeleteRenderbuffers(1, &target.depthRbo);
+}
+
+
+// Dumps the CPU markers recorded so far as a Chrome trace (chrome://tracing, ui.perfetto.dev)
+void UWriteCPUTrace()
+{
+    const char* path = gCPUTracePath ? gCPUTracePath : DEFAULT_CPU_TRACE_PATH;
+    if (CPUProfiler::writeChromeTrace(path))
+        cout << "INFO: CPU trace written to " << path << endl;
+    else
+        cout << "Failed to write CPU trace to " << path << endl;
+}
+
+
+// Writes one "frame,milliseconds" line per frame
+bool UWriteFrameTimes(const char* filename, const std::vector<double>& frameTimes)
+{
+    FILE* file = fopen(filename, "w");
+    if (!file)
+        return false;
+
+    fprintf(file, "frame,ms\n");
+    for (size_t i = 0; i < frameTimes.size(); ++i)
+        fprintf(file, "%zu,%.4f\n", i, frameTimes[i]);
+    return fclose(file) == 0;
+}
+
+
+// Writes the frame statistics to <prefix>.csv and <prefix>.json
+void UWriteFrameStats()
+{
+    std::string prefix(gFrameStatsPrefix);
+    if (!gFrameStats.writeCsv((prefix + ".csv").c_str()) || !gFrameStats.writeJson((prefix + ".json").c_str()))
+        cout << "Failed to write frame statistics to " << prefix << ".csv/.json" << endl;
+}
+
+
 // glfw: whenever the mouse moves, this callback is called
 // -------------------------------------------------------
 void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
 {
+    // Replays ignore live camera input
+    if (gReplayPath)
+        return;
+
     if (gFirstMouse)
     {
         gLastX = xpos;
@@ -736,6 +1211,9 @@ void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
 // ----------------------------------------------------------------------
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset)
 {
+    if (gReplayPath)
+        return;
+
     gCamera.ProcessMouseScroll(yoffset);
 }
 
@@ -779,88 +1257,157 @@ void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 }
 
 
-// Functioned called to render a frame
-void URenderContainer()
+// Adds one mesh instance to this frame's draws
+void UAddMeshDraw(DrawGroupId group, GLuint mesh, const glm::mat4& model, GLuint materialIndex)
 {
+    MeshDraw draw;
+    draw.group = group;
+    draw.mesh = mesh;
+    draw.instance.model = model;
+    draw.instance.materialIndex = materialIndex;
+    gMeshDraws.push_back(draw);
+}
 
-    // Enable z-depth
-    glEnable(GL_DEPTH_TEST);
 
-    // 1. Scales the object 
-    glm::mat4 scale = glm::scale(glm::vec3(2.0f, 2.0f, 2.0f));
-    // 2. Rotates shape by 'n' degrees in the x axis
-    glm::mat4 rotation = glm::rotate(45.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    // 3. Place object
-    glm::mat4 translation = glm::translate(glm::vec3(3.0f, 2.0f, 0.0f));
-    // Model matrix: transformations are applied right-to-left order
-    glm::mat4 model = translation * rotation * scale;
+// Removes the mesh draws whose bounds lie outside the view frustum, before any GL call is made for them
+void UCullMeshDraws(const FrameContext& frame)
+{
+    CPU_PROFILE_FUNCTION();
+    gCuller.clear();
+    for (size_t i = 0; i < gMeshDraws.size(); ++i)
+        gCuller.add(gMesh.bounds[gMeshDraws[i].mesh], gMeshDraws[i].instance.model);
+    gCuller.cull(frame.frustum);
+
+    // Visible indices are ascending, so the survivors can be compacted in place
+    const std::vector<uint32_t>& visible = gCuller.getVisible();
+    for (size_t i = 0; i < visible.size(); ++i)
+        gMeshDraws[i] = gMeshDraws[visible[i]];
+    gMeshDraws.resize(visible.size());
+}
 
 
-    glm::mat4 projection;
-    glm::mat4 view;
+// Orders mesh draws by group, then by mesh, so each mesh's instances end up contiguous
+bool UCompareMeshDraws(const MeshDraw& a, const MeshDraw& b)
+{
+    if (a.group != b.group)
+        return a.group < b.group;
+    return a.mesh < b.mesh;
+}
 
-    //Orthographic View option
-    if (orthoView) {
-        GLfloat oWidth = (GLfloat)WINDOW_WIDTH * 0.01f; // 10% of width
-        GLfloat oHeight = (GLfloat)WINDOW_HEIGHT * 0.01f; // 10% of height
 
-        view = gCamera.GetViewMatrix();
-        projection = glm::ortho(-oWidth, oWidth, oHeight, -oHeight, 0.1f, 100.0f);
-    }
-    // camera/view transformation
-    else {
-        view = gCamera.GetViewMatrix();
-        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+// Turns this frame's mesh draws into instance data and indirect commands, then queues one
+// multi-draw per group: every instance of a mesh shares a command, and baseInstance points the
+// command at its first instance
+void UQueueMeshDraws(const FrameContext& frame)
+{
+    CPU_PROFILE_FUNCTION();
+    if (gMeshDraws.empty())
+        return;
+
+    std::sort(gMeshDraws.begin(), gMeshDraws.end(), UCompareMeshDraws);
+
+    gFrameInstances.clear();
+    gFrameCommands.clear();
+
+    // Command range and nearest instance of each group
+    GLsizei groupFirstCommand[GROUP_COUNT];
+    GLsizei groupCommandCount[GROUP_COUNT];
+    float groupNearest[GROUP_COUNT];
+    for (int i = 0; i < GROUP_COUNT; ++i)
+    {
+        groupFirstCommand[i] = 0;
+        groupCommandCount[i] = 0;
+        groupNearest[i] = Z_FAR;
     }
 
-    // Set the shader to be used
-    glUseProgram(gContainerProgramId);
+    for (size_t i = 0; i < gMeshDraws.size(); ++i)
+    {
+        const MeshDraw& draw = gMeshDraws[i];
 
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(gContainerProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gContainerProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gContainerProgramId, "projection");
+        // A new command starts whenever the mesh or the group changes
+        if (i == 0 || UCompareMeshDraws(gMeshDraws[i - 1], draw))
+        {
+            if (groupCommandCount[draw.group] == 0)
+                groupFirstCommand[draw.group] = (GLsizei)gFrameCommands.size();
+            ++groupCommandCount[draw.group];
+
+            const MeshRange& range = gMesh.ranges[draw.mesh];
+            DrawElementsIndirectCommand command;
+            command.count = range.nIndices;
+            command.instanceCount = 0;
+            command.firstIndex = range.firstIndex;
+            command.baseVertex = range.baseVertex;
+            command.baseInstance = (GLuint)gFrameInstances.size();
+            gFrameCommands.push_back(command);
+        }
+        ++gFrameCommands.back().instanceCount;
+        gFrameInstances.push_back(draw.instance);
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+        glm::vec4 viewPosition = frame.view * draw.instance.model[3];
+        if (-viewPosition.z < groupNearest[draw.group])
+            groupNearest[draw.group] = -viewPosition.z;
+    }
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gMesh.containerVao);
+    // Normal matrices of the surviving instances, in one batched pass
+    NormalMatrix::computeBatch(&gFrameInstances[0].model, sizeof(InstanceData), &gFrameInstances[0].normalMatrix, sizeof(InstanceData), gFrameInstances.size());
 
-    // Reference matrix uniforms from the Pyramid Shader program for the shape color, light color, light position, and camera position
-    GLint objectColorLoc = glGetUniformLocation(gContainerProgramId, "objectColor");
-    GLint lightColorLoc = glGetUniformLocation(gContainerProgramId, "lightColor");
-    GLint lightPositionLoc = glGetUniformLocation(gContainerProgramId, "lightPos");
-    GLint viewPositionLoc = glGetUniformLocation(gContainerProgramId, "viewPosition");
+    // Orphan the previous frame's storage so the uploads never wait on the GPU
+    GLsizeiptr instanceSize = gFrameInstances.size() * sizeof(InstanceData);
+    gGLState.bindBuffer(GL_ARRAY_BUFFER, gMesh.instanceVbo);
+    glBufferData(GL_ARRAY_BUFFER, instanceSize, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, instanceSize, gFrameInstances.data());
 
-    // Pass color, light, and camera data to the Pyramid Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-    glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
-    const glm::vec3 cameraPosition = gCamera.Position;
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+    // The command buffer stays bound for the multi-draws
+    GLsizeiptr commandSize = gFrameCommands.size() * sizeof(DrawElementsIndirectCommand);
+    gGLState.bindBuffer(GL_DRAW_INDIRECT_BUFFER, gMesh.commandBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, commandSize, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commandSize, gFrameCommands.data());
 
-    GLint UVScaleLoc = glGetUniformLocation(gContainerProgramId, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
+    // Commands of a group are contiguous, so each group is one draw call, sorted by its nearest instance
+    for (int group = 0; group < GROUP_COUNT; ++group)
+    {
+        if (groupCommandCount[group] == 0)
+            continue;
+
+        const DrawGroup& drawGroup = gDrawGroups[group];
+        DrawItem item = DrawItem();
+        item.pass = drawGroup.pass;
+        item.program = drawGroup.program->id;
+        item.vao = gMesh.vao;
+        item.texture = drawGroup.texture;
+        item.depth = groupNearest[group] / Z_FAR;
+        item.material = &drawGroup;
+        item.bindMaterial = drawGroup.bindMaterial;
+        item.mode = GL_TRIANGLES;
+        item.indexType = GL_UNSIGNED_INT;
+        item.drawCount = groupCommandCount[group];
+        item.indirectOffset = groupFirstCommand[group] * sizeof(DrawElementsIndirectCommand);
+        item.name = drawGroup.name;
+
+        gRenderQueue.push(item);
+    }
+}
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureContainer);
 
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, gMesh.nContainerVertices);
+// Functions called to queue the objects of a frame
+void URenderContainer()
+{
+    CPU_PROFILE_FUNCTION();
+    // 1. Scales the object 
+    glm::mat4 scale = glm::scale(glm::vec3(2.0f, 2.0f, 2.0f));
+    // 2. Rotates shape by 'n' degrees in the x axis
+    glm::mat4 rotation = glm::rotate(45.0f, glm::vec3(1.0, 1.0f, 1.0f));
+    // 3. Place object
+    glm::mat4 translation = glm::translate(glm::vec3(3.0f, 2.0f, 0.0f));
+    // Model matrix: transformations are applied right-to-left order
+    glm::mat4 model = translation * rotation * scale;
 
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
+    UAddMeshDraw(GROUP_CONTAINER, gMesh.container, model, MATERIAL_CONTAINER);
 }
 
 void URenderPlane()
 {
-
-    // Enable z-depth
-    glEnable(GL_DEPTH_TEST);
-
+    CPU_PROFILE_FUNCTION();
     // 1. Scales the object 
     glm::mat4 scale = glm::scale(glm::vec3(5.0f, 5.0f, 5.0f));
     // 2. Rotates shape 
@@ -870,71 +1417,12 @@ void URenderPlane()
     // Model matrix: transformations are applied right-to-left order
     glm::mat4 model = translation * rotation * scale;
 
-    glm::mat4 projection;
-    glm::mat4 view;
-
-    //Orthographic View option
-    if (orthoView) {
-        GLfloat oWidth = (GLfloat)WINDOW_WIDTH * 0.01f; // 10% of width
-        GLfloat oHeight = (GLfloat)WINDOW_HEIGHT * 0.01f; // 10% of height
-
-        view = gCamera.GetViewMatrix();
-        projection = glm::ortho(-oWidth, oWidth, oHeight, -oHeight, 0.1f, 100.0f);
-    }
-    // camera/view transformation
-    else {
-        view = gCamera.GetViewMatrix();
-        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
-    }
-
-    // Set the shader to be used
-    glUseProgram(gPlaneProgramId);
-
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(gPlaneProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gPlaneProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gPlaneProgramId, "projection");
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gMesh.planeVao);
-
-    // Reference matrix uniforms from the Pyramid Shader program for the shape color, light color, light position, and camera position
-    GLint objectColorLoc = glGetUniformLocation(gPlaneProgramId, "objectColor");
-    GLint lightColorLoc = glGetUniformLocation(gPlaneProgramId, "lightColor");
-    GLint lightPositionLoc = glGetUniformLocation(gPlaneProgramId, "lightPos");
-    GLint viewPositionLoc = glGetUniformLocation(gPlaneProgramId, "viewPosition");
-
-    // Pass color, light, and camera data to the Pyramid Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-    glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
-    const glm::vec3 cameraPosition = gCamera.Position;
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
-
-    GLint UVScaleLoc = glGetUniformLocation(gPlaneProgramId, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTexturePlane);
-
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, gMesh.nPlaneVertices);
-
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
+    UAddMeshDraw(GROUP_PLANE, gMesh.plane, model, MATERIAL_PLANE);
 }
 
-void URenderLamp()
+// Model matrix of the lamp, also used by the sphere
+glm::mat4 ULampModel()
 {
-
-    // Enable z-depth
-    glEnable(GL_DEPTH_TEST);
-
     // 1. Scales the object
     glm::mat4 scale = glm::scale(glm::vec3(1.25f, 1.25f, 1.25f));
     // 2. Rotates shape 
@@ -942,137 +1430,25 @@ void URenderLamp()
     // 3. Place object 
     glm::mat4 translation = glm::translate(glm::vec3(-1.0f, -7.0f, 5.0f));
     // Model matrix: transformations are applied right-to-left order
-    glm::mat4 model = translation * rotation * scale;
-
-    glm::mat4 projection;
-    glm::mat4 view;
-
-    //Orthographic View option
-    if (orthoView) {
-        GLfloat oWidth = (GLfloat)WINDOW_WIDTH * 0.01f; // 10% of width
-        GLfloat oHeight = (GLfloat)WINDOW_HEIGHT * 0.01f; // 10% of height
-
-        view = gCamera.GetViewMatrix();
-        projection = glm::ortho(-oWidth, oWidth, oHeight, -oHeight, 0.1f, 100.0f);
-    }
-    // camera/view transformation
-    else {
-        view = gCamera.GetViewMatrix();
-        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
-    }
-
-    // Set the shader to be used
-    glUseProgram(gLampProgramId);
-
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(gLampProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gLampProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gLampProgramId, "projection");
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gMesh.lampVao);
-
-    // Reference matrix uniforms from the Pyramid Shader program for the shape color, light color, light position, and camera position
-    GLint objectColorLoc = glGetUniformLocation(gLampProgramId, "objectColor");
-    GLint lightColorLoc = glGetUniformLocation(gLampProgramId, "lightColor");
-    GLint lightPositionLoc = glGetUniformLocation(gLampProgramId, "lightPos");
-    GLint viewPositionLoc = glGetUniformLocation(gLampProgramId, "viewPosition");
-
-    // Pass color, light, and camera data to the Pyramid Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-    glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
-    const glm::vec3 cameraPosition = gCamera.Position;
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
-
-    GLint UVScaleLoc = glGetUniformLocation(gLampProgramId, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, gMesh.nLampVertices);
+    return translation * rotation * scale;
+}
 
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
+void URenderLamp()
+{
+    CPU_PROFILE_FUNCTION();
+    UAddMeshDraw(GROUP_LAMP, gMesh.lamp, ULampModel(), 0);
 }
 
 void URenderSphere()
 {    
-    // creates sphere object
-    ShapeData sphere = ShapeGenerator::makeSphere();
-
-    unsigned int sphereVBO{}, sphereVAO;
-    glGenVertexArrays(1, &sphereVAO);
-    glGenBuffers(1, &sphereVBO);
-    glBindVertexArray(sphereVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, sphereVBO);
-    glBufferData(GL_ARRAY_BUFFER, sphere.vertexBufferSize() + sphere.indexBufferSize(), 0, GL_STATIC_DRAW);
-    int currentOffset = 0;
-    glBufferSubData(GL_ARRAY_BUFFER, currentOffset, sphere.vertexBufferSize(), sphere.vertices);
-    currentOffset += sphere.vertexBufferSize();
-    int sphereIndexByteOffset = currentOffset;
-    glBufferSubData(GL_ARRAY_BUFFER, currentOffset, sphere.indexBufferSize(), sphere.indices);
-    int sphereNumIndices = sphere.numIndices;
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, VERTEX_BYTE_SIZE, (void*)0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, VERTEX_BYTE_SIZE, (void*)(sizeof(float) * 3));
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, VERTEX_BYTE_SIZE, (void*)(sizeof(float) * 6));
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphereVBO);
-    
-    // setup to draw sphere
-    glBindTexture(GL_TEXTURE_2D, gTextureSphere);
-    glBindVertexArray(sphereVAO);
-    glm::mat4(1.0f);
-    glm::translate(glm::vec3(0.0f, 7.1f, -2.0f));
-    glm::scale(glm::vec3(5.5f));
-
-    // draw sphere
-    glDrawElements(GL_TRIANGLES, sphereNumIndices, GL_UNSIGNED_SHORT, (void*)sphereIndexByteOffset);
-
-    // Enable z-depth
-    glEnable(GL_DEPTH_TEST);
-
-    //// 1. Scales the object 
-    //glm::mat4 scale = glm::scale(glm::vec3(5.0f, 0.0f, 5.0f));
-    //// 2. Rotates shape by 'n' degrees in the x axis
-    //glm::mat4 rotation = glm::rotate(45.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    //// 3. Place object at the origin
-    //glm::mat4 translation = glm::translate(glm::vec3(0.0f, 0.0f, 0.0f));
-    //// Model matrix: transformations are applied right-to-left order
-    //glm::mat4 model = translation * rotation * scale;
-
-    glm::mat4 projection;
-    glm::mat4 view;
-
-    //Orthographic View option
-    if (orthoView) {
-        GLfloat oWidth = (GLfloat)WINDOW_WIDTH * 0.01f; // 10% of width
-        GLfloat oHeight = (GLfloat)WINDOW_HEIGHT * 0.01f; // 10% of height
-
-        view = gCamera.GetViewMatrix();
-        projection = glm::ortho(-oWidth, oWidth, oHeight, -oHeight, 0.1f, 100.0f);
-    }
-    // camera/view transformation
-    else {
-        view = gCamera.GetViewMatrix();
-        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
-    }
-
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
+    CPU_PROFILE_FUNCTION();
+    // sphere mesh is built once at startup; it is drawn with the lamp's program and transform
+    UAddMeshDraw(GROUP_LAMP, gMesh.sphereHandle, ULampModel(), 0);
 }
 
 void URenderBook()
 {
-
-    // Enable z-depth
-    glEnable(GL_DEPTH_TEST);
-
+    CPU_PROFILE_FUNCTION();
     // 1. Scales the object 
     glm::mat4 scale = glm::scale(glm::vec3(7.0f, 5.0f, 5.0f));
     // 2. Rotates shape by 'n' degrees in the x axis
@@ -1082,64 +1458,42 @@ void URenderBook()
     // Model matrix: transformations are applied right-to-left order
     glm::mat4 model = translation * rotation * scale;
 
+    UAddMeshDraw(GROUP_BOOK, gMesh.book, model, MATERIAL_BOOK);
+}
 
-    glm::mat4 projection;
-    glm::mat4 view;
 
-    //Orthographic View option
-    if (orthoView) {
-        GLfloat oWidth = (GLfloat)WINDOW_WIDTH * 0.01f; // 10% of width
-        GLfloat oHeight = (GLfloat)WINDOW_HEIGHT * 0.01f; // 10% of height
+// Uploads the material table read by the lit program, in MaterialSlot order
+void UCreateMaterialBuffer(GLuint& ssbo)
+{
+    const Material* materials[MATERIAL_COUNT] = { &gContainerMaterial, &gPlaneMaterial, &gBookMaterial };
 
-        view = gCamera.GetViewMatrix();
-        projection = glm::ortho(-oWidth, oWidth, oHeight, -oHeight, 0.1f, 100.0f);
-    }
-    // camera/view transformation
-    else {
-        view = gCamera.GetViewMatrix();
-        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+    MaterialData data[MATERIAL_COUNT];
+    for (int i = 0; i < MATERIAL_COUNT; ++i)
+    {
+        data[i].ambientStrength = materials[i]->ambientStrength;
+        data[i].specularStrength = materials[i]->specularStrength;
+        data[i].uvScale = materials[i]->uvScale;
     }
 
-    // Set the shader to be used
-    glUseProgram(gBookProgramId);
-
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(gBookProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gBookProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gBookProgramId, "projection");
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gMesh.bookVao);
+    glGenBuffers(1, &ssbo);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(data), data, GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-    // Reference matrix uniforms from the Pyramid Shader program for the shape color, light color, light position, and camera position
-    GLint objectColorLoc = glGetUniformLocation(gBookProgramId, "objectColor");
-    GLint lightColorLoc = glGetUniformLocation(gBookProgramId, "lightColor");
-    GLint lightPositionLoc = glGetUniformLocation(gBookProgramId, "lightPos");
-    GLint viewPositionLoc = glGetUniformLocation(gBookProgramId, "viewPosition");
-
-    // Pass color, light, and camera data to the Pyramid Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-    glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
-    const glm::vec3 cameraPosition = gCamera.Position;
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_BUFFER_BINDING, ssbo);
+}
 
-    GLint UVScaleLoc = glGetUniformLocation(gBookProgramId, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureBook);
+void UDestroyMaterialBuffer(GLuint ssbo)
+{
+    glDeleteBuffers(1, &ssbo);
+}
 
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, gMesh.nBookVertices);
 
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
+// Render queue callback of lit groups: materials come from the material buffer, only the user texture scale is set
+void UBindLitGroup(const void*)
+{
+    glUniform2fv(gLitProgram.uniforms[UNIFORM_UV_SCALE], 1, glm::value_ptr(gUVScale));
 }
 
 
@@ -1226,30 +1580,8 @@ void containerMesh(GLMesh& mesh)
     };
 
 
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerNormal = 3;
-    const GLuint floatsPerUV = 2;
-
-    //Container vertices
-    mesh.nContainerVertices = sizeof(containerVerts) / (sizeof(containerVerts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-
-    glGenVertexArrays(1, &mesh.containerVao); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.containerVao);
-
-    // Create VBO
-    glGenBuffers(1, &mesh.containerVbo);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.containerVbo); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(containerVerts), containerVerts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-    // Strides between vertex coordinates
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
-
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
-
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
+    // Appended to the shared mesh buffers, uploaded by UUploadMeshes
+    mesh.container = UAddTriangleList(mesh, containerVerts, sizeof(containerVerts) / sizeof(containerVerts[0]));
 }
 
 void planeMesh(GLMesh& mesh)
@@ -1272,30 +1604,8 @@ void planeMesh(GLMesh& mesh)
     };
 
 
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerNormal = 3;
-    const GLuint floatsPerUV = 2;
-
-    //Container vertices
-    mesh.nPlaneVertices = sizeof(planeVerts) / (sizeof(planeVerts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-
-    glGenVertexArrays(1, &mesh.planeVao); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.planeVao);
-
-    // Create VBO
-    glGenBuffers(1, &mesh.planeVbo);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.planeVbo); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(planeVerts), planeVerts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-    // Strides between vertex coordinates
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
-
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
-
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
+    // Appended to the shared mesh buffers, uploaded by UUploadMeshes
+    mesh.plane = UAddTriangleList(mesh, planeVerts, sizeof(planeVerts) / sizeof(planeVerts[0]));
 }
 
 void lampMesh(GLMesh& mesh)
@@ -1352,30 +1662,8 @@ void lampMesh(GLMesh& mesh)
     };
 
 
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerNormal = 3;
-    const GLuint floatsPerUV = 2;
-
-    // vertices
-    mesh.nLampVertices = sizeof(lampVerts) / (sizeof(lampVerts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-
-    glGenVertexArrays(1, &mesh.lampVao); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.lampVao);
-
-    // Create VBO
-    glGenBuffers(1, &mesh.lampVbo);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.lampVbo); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(lampVerts), lampVerts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-    // Strides between vertex coordinates
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
-
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
-
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
+    // Appended to the shared mesh buffers, uploaded by UUploadMeshes
+    mesh.lamp = UAddTriangleList(mesh, lampVerts, sizeof(lampVerts) / sizeof(lampVerts[0]));
 }
 
 
@@ -1433,107 +1721,465 @@ void bookMesh(GLMesh& mesh)
     };
 
 
+    // Appended to the shared mesh buffers, uploaded by UUploadMeshes
+    mesh.book = UAddTriangleList(mesh, bookVerts, sizeof(bookVerts) / sizeof(bookVerts[0]));
+}
+
+
+// Builds every mesh of the scene into the pending mesh data
+void UBuildMeshes(GLMesh& mesh)
+{
+    containerMesh(mesh);
+    planeMesh(mesh);
+    lampMesh(mesh);
+    bookMesh(mesh);
+    mesh.sphereHandle = UGetShapeMesh(mesh, SHAPE_SPHERE, SPHERE_TESSELATION);
+}
+
+
+// Appends a non-indexed triangle list (position, normal, texture coordinate per vertex) to the
+// pending mesh data and returns its mesh handle; it is drawn with sequential indices
+GLuint UAddTriangleList(GLMesh& mesh, const GLfloat* vertexData, GLuint nFloats)
+{
     const GLuint floatsPerVertex = 3;
     const GLuint floatsPerNormal = 3;
     const GLuint floatsPerUV = 2;
+    const GLuint stride = floatsPerVertex + floatsPerNormal + floatsPerUV;
 
-    // vertices
-    mesh.nBookVertices = sizeof(bookVerts) / (sizeof(bookVerts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
+    MeshRange range;
+    range.firstIndex = mesh.nIndices + (GLuint)mesh.pendingIndices.size();
+    range.nIndices = nFloats / stride;
+    range.baseVertex = (GLint)(mesh.nVertices + mesh.pendingVertices.size());
 
-    glGenVertexArrays(1, &mesh.bookVao); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.bookVao);
+    for (GLuint i = 0; i < range.nIndices; ++i)
+    {
+        const GLfloat* v = vertexData + i * stride;
+        MeshVertex vertex;
+        vertex.position = glm::vec3(v[0], v[1], v[2]);
+        vertex.normal = glm::vec3(v[3], v[4], v[5]);
+        vertex.textureCoordinate = glm::vec2(v[6], v[7]);
+        mesh.pendingVertices.push_back(vertex);
+        mesh.pendingIndices.push_back(i);
+    }
+
+    GLuint handle = (GLuint)mesh.ranges.size();
+    mesh.ranges.push_back(range);
+    mesh.bounds.push_back(BoundingVolume::fromPositions(&mesh.pendingVertices[range.baseVertex - mesh.nVertices].position, range.nIndices, sizeof(MeshVertex)));
+    return handle;
+}
+
+
+// Returns the handle of a generated shape, building it the first time it is requested.
+// New shapes are appended to the pending mesh data; call UUploadMeshes before drawing them.
+GLuint UGetShapeMesh(GLMesh& mesh, ShapeKind kind, uint tesselation)
+{
+    std::pair<int, uint> key(kind, tesselation);
+    std::map<std::pair<int, uint>, GLuint>::iterator found = mesh.shapeHandles.find(key);
+    if (found != mesh.shapeHandles.end())
+        return found->second;
+
+    ShapeData shape = (kind == SHAPE_SPHERE) ? ShapeGenerator::makeSphere(tesselation) : ShapeGenerator::makePlane(tesselation);
+
+    MeshRange range;
+    range.firstIndex = mesh.nIndices + (GLuint)mesh.pendingIndices.size();
+    range.nIndices = shape.numIndices;
+    range.baseVertex = (GLint)(mesh.nVertices + mesh.pendingVertices.size());
+
+    // Generated shapes carry a color instead of texture coordinates; only the position and normal are kept
+    for (GLuint i = 0; i < shape.numVertices; ++i)
+    {
+        MeshVertex vertex;
+        vertex.position = shape.vertices[i].position;
+        vertex.normal = shape.vertices[i].normal;
+        vertex.textureCoordinate = glm::vec2(0.0f);
+        mesh.pendingVertices.push_back(vertex);
+    }
+    mesh.pendingIndices.insert(mesh.pendingIndices.end(), shape.indices, shape.indices + shape.numIndices);
+
+    // The pending data holds its own copy, release the generator's
+    shape.cleanup();
+
+    GLuint handle = (GLuint)mesh.ranges.size();
+    mesh.ranges.push_back(range);
+    mesh.bounds.push_back(shape.bounds);
+    mesh.shapeHandles[key] = handle;
+    return handle;
+}
+
+
+// Grows a buffer to hold newSize bytes, keeping its first usedSize bytes
+void UGrowBuffer(GLuint& buffer, GLsizeiptr usedSize, GLsizeiptr newSize)
+{
+    GLuint grown;
+    glGenBuffers(1, &grown);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+    glBufferData(GL_COPY_WRITE_BUFFER, newSize, NULL, GL_STATIC_DRAW);
+    if (usedSize > 0)
+    {
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, usedSize);
+    }
+    glDeleteBuffers(1, &buffer);
+    buffer = grown;
+}
+
+
+// Moves the pending mesh data into the shared vertex and index buffers, creating the shared VAO on first use.
+// Every mesh and every per-instance attribute is read through this one VAO.
+void UUploadMeshes(GLMesh& mesh)
+{
+    if (mesh.vao == 0)
+    {
+        glGenVertexArrays(1, &mesh.vao);
+        glGenBuffers(1, &mesh.instanceVbo);
+        glGenBuffers(1, &mesh.commandBuffer);
+        gGLState.bindVertexArray(mesh.vao);
+
+        // Binding 0: mesh vertices
+        glVertexAttribFormat(0, 3, GL_FLOAT, GL_FALSE, offsetof(MeshVertex, position));
+        glVertexAttribFormat(1, 3, GL_FLOAT, GL_FALSE, offsetof(MeshVertex, normal));
+        glVertexAttribFormat(2, 2, GL_FLOAT, GL_FALSE, offsetof(MeshVertex, textureCoordinate));
+        for (GLuint attribute = 0; attribute < 3; ++attribute)
+        {
+            glVertexAttribBinding(attribute, 0);
+            glEnableVertexAttribArray(attribute);
+        }
+
+        // Binding 1: per-instance data, a mat4 takes four vec4 locations, then the material slot and the mat3 normal matrix
+        for (GLuint column = 0; column < 4; ++column)
+        {
+            glVertexAttribFormat(3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4) * column);
+            glVertexAttribBinding(3 + column, 1);
+            glEnableVertexAttribArray(3 + column);
+        }
+        glVertexAttribIFormat(7, 1, GL_UNSIGNED_INT, offsetof(InstanceData, materialIndex));
+        glVertexAttribBinding(7, 1);
+        glEnableVertexAttribArray(7);
+        for (GLuint column = 0; column < 3; ++column)
+        {
+            glVertexAttribFormat(8 + column, 3, GL_FLOAT, GL_FALSE, offsetof(InstanceData, normalMatrix) + sizeof(glm::vec3) * column);
+            glVertexAttribBinding(8 + column, 1);
+            glEnableVertexAttribArray(8 + column);
+        }
+        glVertexBindingDivisor(1, 1);
+        glBindVertexBuffer(1, mesh.instanceVbo, 0, sizeof(InstanceData));
+    }
+
+    if (mesh.pendingVertices.empty())
+        return;
+
+    UAppendMeshData(mesh, mesh.pendingVertices.data(), (GLuint)mesh.pendingVertices.size(), mesh.pendingIndices.data(), (GLuint)mesh.pendingIndices.size());
+    mesh.pendingVertices.clear();
+    mesh.pendingIndices.clear();
+}
 
-    // Create VBO
-    glGenBuffers(1, &mesh.bookVbo);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.bookVbo); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(bookVerts), bookVerts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
 
-    // Strides between vertex coordinates
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
+// Grows the shared vertex and index buffers by the given data, which the caller has already described in mesh.ranges
+void UAppendMeshData(GLMesh& mesh, const MeshVertex* vertices, GLuint nVertices, const GLuint* indices, GLuint nIndices)
+{
+    GLuint totalVertices = mesh.nVertices + nVertices;
+    GLuint totalIndices = mesh.nIndices + nIndices;
+
+    UGrowBuffer(mesh.vbo, mesh.nVertices * sizeof(MeshVertex), totalVertices * sizeof(MeshVertex));
+    glBufferSubData(GL_COPY_WRITE_BUFFER, mesh.nVertices * sizeof(MeshVertex), nVertices * sizeof(MeshVertex), vertices);
 
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
+    UGrowBuffer(mesh.ibo, mesh.nIndices * sizeof(GLuint), totalIndices * sizeof(GLuint));
+    glBufferSubData(GL_COPY_WRITE_BUFFER, mesh.nIndices * sizeof(GLuint), nIndices * sizeof(GLuint), indices);
 
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
+    // Point the VAO at the grown buffers
+    gGLState.bindVertexArray(mesh.vao);
+    glBindVertexBuffer(0, mesh.vbo, 0, sizeof(MeshVertex));
+    gGLState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ibo);
+
+    mesh.nVertices = totalVertices;
+    mesh.nIndices = totalIndices;
 }
 
 
 void UDestroyMesh(GLMesh& mesh)
 {
-    glDeleteVertexArrays(1, &mesh.containerVao);
-    glDeleteBuffers(1, &mesh.containerVbo);
+    glDeleteVertexArrays(1, &mesh.vao);
+    glDeleteBuffers(1, &mesh.vbo);
+    glDeleteBuffers(1, &mesh.ibo);
+    glDeleteBuffers(1, &mesh.instanceVbo);
+    glDeleteBuffers(1, &mesh.commandBuffer);
+    mesh.vao = mesh.vbo = mesh.ibo = mesh.instanceVbo = mesh.commandBuffer = 0;
+    mesh.nVertices = mesh.nIndices = 0;
+
+    mesh.ranges.clear();
+    mesh.bounds.clear();
+    mesh.shapeHandles.clear();
+}
 
-    glDeleteVertexArrays(1, &mesh.planeVao);
-    glDeleteBuffers(1, &mesh.planeVbo);
 
-    glDeleteVertexArrays(1, &mesh.lampVao);
-    glDeleteBuffers(1, &mesh.lampVbo);
 
-    glDeleteVertexArrays(1, &mesh.bookVao);
-    glDeleteBuffers(1, &mesh.bookVbo);
+// Acquires the texture of a source image, loading the KTX2 file TextureBaker wrote next to it when
+// there is one: block-compressed levels are uploaded directly, with no decode or mip generation
+GLuint UAcquireTexture(const char* source)
+{
+    // Packed images are uploaded from the mapping as they are; block-compressed ones need S3TC
+    const AssetPackEntry* packed = gAssetPack.isOpen() ? gAssetPack.find(source, ASSET_TEXTURE) : nullptr;
+    if (packed)
+    {
+        const unsigned char* data = gAssetPack.data(*packed);
+        Ktx2Image image;
+        if (Ktx2File::parse(data, (size_t)packed->size, image) && (GLEW_EXT_texture_compression_s3tc || !Ktx2File::isCompressed(image.vkFormat)))
+            return gTextureCache.acquireMapped(source, data, (size_t)packed->size, packed->hash, gGLState);
+    }
+
+    std::string path = source;
+    if (GLEW_EXT_texture_compression_s3tc)
+    {
+        std::string baked = Ktx2File::bakedPath(source);
+        if (FileUtils::exists(baked.c_str()))
+            path = baked;
+    }
+    return gTextureCache.acquire(path.c_str(), gGLState);
 }
 
 
+// --write-pack: gathers the scene's meshes, shader sources and textures into one asset pack, so that
+// loading it reads no other file and decodes nothing
+bool UWriteAssetPack(const char* path)
+{
+    // Meshes are built as at startup and stored as the buffers UUploadMeshes would fill
+    GLMesh mesh = GLMesh();
+    UBuildMeshes(mesh);
+
+    PackedMeshTable table = { mesh.container, mesh.plane, mesh.lamp, mesh.book, mesh.sphereHandle, SPHERE_TESSELATION, (GLuint)mesh.ranges.size() };
+    std::vector<unsigned char> tableData(sizeof(table) + mesh.ranges.size() * sizeof(PackedMesh));
+    memcpy(tableData.data(), &table, sizeof(table));
+    for (size_t i = 0; i < mesh.ranges.size(); ++i)
+    {
+        PackedMesh packedMesh = { mesh.ranges[i], mesh.bounds[i] };
+        memcpy(&tableData[sizeof(table) + i * sizeof(PackedMesh)], &packedMesh, sizeof(packedMesh));
+    }
+
+    AssetPackWriter writer;
+    bool ok = writer.add("meshes/vertices", ASSET_BUFFER, mesh.pendingVertices.data(), mesh.pendingVertices.size() * sizeof(MeshVertex))
+        && writer.add("meshes/indices", ASSET_BUFFER, mesh.pendingIndices.data(), mesh.pendingIndices.size() * sizeof(GLuint))
+        && writer.add("meshes/table", ASSET_BUFFER, tableData.data(), tableData.size())
+        && writer.add("shaders/lit.vert", ASSET_SHADER, litVertexShaderSource, strlen(litVertexShaderSource) + 1)
+        && writer.add("shaders/lit.frag", ASSET_SHADER, litFragmentShaderSource, strlen(litFragmentShaderSource) + 1)
+        && writer.add("shaders/lamp.vert", ASSET_SHADER, lampVertexShaderSource, strlen(lampVertexShaderSource) + 1)
+        && writer.add("shaders/lamp.frag", ASSET_SHADER, lampFragmentShaderSource, strlen(lampFragmentShaderSource) + 1);
+
+    // Images used by several objects are packed once under their name
+    const char* textures[] = { TEXTURE_CONTAINER, TEXTURE_PLANE, TEXTURE_BOOK, TEXTURE_SPHERE };
+    const int nTextures = sizeof(textures) / sizeof(textures[0]);
+    for (int i = 0; ok && i < nTextures; ++i)
+    {
+        int first = 0;
+        while (strcmp(textures[first], textures[i]) != 0)
+            ++first;
+        if (first == i)
+            ok = UPackTexture(writer, textures[i]);
+    }
+
+    if (!ok || !writer.write(path, UPackContentsVersion()))
+    {
+        cout << "Failed to write asset pack " << path << endl;
+        return false;
+    }
+    cout << "Wrote asset pack " << path << endl;
+    return true;
+}
+
 
-/*Generate and load the texture*/
-bool UCreateTexture(const char* filename, GLuint& textureId)
+// Asset pack contents version of this build: the layout of the packed mesh structs and the built-in shader
+// sources, since packed shaders replace them. Editing a shader or a packed struct refuses older packs.
+uint64_t UPackContentsVersion()
 {
-    int width, height, channels;
-    unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
-    if (image)
-    {
-        flipImageVertically(image, width, height, channels);
-
-        glGenTextures(1, &textureId);
-        glBindTexture(GL_TEXTURE_2D, textureId);
-
-        // set the texture wrapping parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        // set texture filtering parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        if (channels == 3)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-        else if (channels == 4)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-        else
+    const uint64_t layout[] = {
+        PACK_LAYOUT_VERSION,
+        sizeof(MeshVertex), offsetof(MeshVertex, normal), offsetof(MeshVertex, textureCoordinate),
+        sizeof(MeshRange), sizeof(BoundingVolume), sizeof(PackedMeshTable), sizeof(PackedMesh)
+    };
+    std::string contents((const char*)layout, sizeof(layout));
+    const char* shaders[] = { litVertexShaderSource, litFragmentShaderSource, lampVertexShaderSource, lampFragmentShaderSource };
+    for (size_t i = 0; i < sizeof(shaders) / sizeof(shaders[0]); ++i)
+        contents.append(shaders[i], strlen(shaders[i]) + 1);
+    return AssetPack::hash((const unsigned char*)contents.data(), contents.size());
+}
+
+
+// Adds a texture to a pack being written: the KTX2 file TextureBaker left next to the source when there
+// is one, otherwise the source decoded here, with the same mip chain the loader would have built
+bool UPackTexture(AssetPackWriter& writer, const char* source)
+{
+    std::vector<unsigned char> contents;
+    std::string baked = Ktx2File::bakedPath(source);
+    if (FileUtils::exists(baked.c_str()))
+    {
+        if (!FileUtils::readAll(baked.c_str(), contents))
+        {
+            cout << "Failed to read " << baked << endl;
+            return false;
+        }
+    }
+    else
+    {
+        // Top row first, as the loader leaves every image
+        stbi_set_flip_vertically_on_load(0);
+        int width, height, channels;
+        unsigned char* pixels = stbi_load(source, &width, &height, &channels, 0);
+        if (!pixels)
         {
-            cout << "Not implemented to handle image with " << channels << " channels" << endl;
+            cout << "Failed to load texture " << source << ": " << stbi_failure_reason() << endl;
+            return false;
+        }
+        if (channels != 3 && channels != 4)
+        {
+            cout << "Not implemented to handle image with " << channels << " channels: " << source << endl;
+            stbi_image_free(pixels);
             return false;
         }
 
-        glGenerateMipmap(GL_TEXTURE_2D);
+        std::vector<MipLevel> levels;
+        MipGenerator::layout(width, height, channels, levels);
+        std::vector<std::vector<unsigned char> > chain(levels.size());
+        chain[0].assign(pixels, pixels + levels[0].size);
+        stbi_image_free(pixels);
 
-        stbi_image_free(image);
-        glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
+        std::vector<unsigned char*> levelPixels;
+        for (size_t i = 0; i < levels.size(); ++i)
+        {
+            chain[i].resize(levels[i].size);
+            levelPixels.push_back(chain[i].data());
+        }
+        MipGenerator::generate(levelPixels, levels, channels, std::max(1u, std::thread::hardware_concurrency()));
 
-        return true;
+        uint32_t vkFormat = channels == 3 ? KTX2_FORMAT_R8G8B8_SRGB : KTX2_FORMAT_R8G8B8A8_SRGB;
+        Ktx2File::serialize(vkFormat, width, height, chain, contents);
+    }
+    return writer.add(source, ASSET_TEXTURE, contents.data(), contents.size());
+}
+
+
+// Fills the mesh table and the shared buffers from an asset pack, uploading the vertices and indices
+// straight from the mapping; false, leaving the mesh untouched, when the pack has no usable meshes
+bool ULoadPackedMeshes(GLMesh& mesh, const AssetPack& pack)
+{
+    const AssetPackEntry* vertices = pack.find("meshes/vertices", ASSET_BUFFER);
+    const AssetPackEntry* indices = pack.find("meshes/indices", ASSET_BUFFER);
+    const AssetPackEntry* tableEntry = pack.find("meshes/table", ASSET_BUFFER);
+    if (!vertices || !indices || !tableEntry || tableEntry->size < sizeof(PackedMeshTable)
+        || vertices->size % sizeof(MeshVertex) != 0 || indices->size % sizeof(GLuint) != 0)
+        return false;
+
+    PackedMeshTable table;
+    memcpy(&table, pack.data(*tableEntry), sizeof(table));
+    const GLuint nVertices = (GLuint)(vertices->size / sizeof(MeshVertex));
+    const GLuint nIndices = (GLuint)(indices->size / sizeof(GLuint));
+    if (tableEntry->size != sizeof(table) + (uint64_t)table.nMeshes * sizeof(PackedMesh)
+        || table.container >= table.nMeshes || table.plane >= table.nMeshes || table.lamp >= table.nMeshes
+        || table.book >= table.nMeshes || table.sphere >= table.nMeshes)
+        return false;
+
+    std::vector<PackedMesh> packedMeshes(table.nMeshes);
+    memcpy(packedMeshes.data(), pack.data(*tableEntry) + sizeof(table), packedMeshes.size() * sizeof(PackedMesh));
+    for (size_t i = 0; i < packedMeshes.size(); ++i)
+    {
+        const MeshRange& range = packedMeshes[i].range;
+        if (range.firstIndex > nIndices || range.nIndices > nIndices - range.firstIndex || range.baseVertex < 0 || (GLuint)range.baseVertex > nVertices)
+            return false;
+    }
+
+    for (size_t i = 0; i < packedMeshes.size(); ++i)
+    {
+        mesh.ranges.push_back(packedMeshes[i].range);
+        mesh.bounds.push_back(packedMeshes[i].bounds);
+    }
+    mesh.container = table.container;
+    mesh.plane = table.plane;
+    mesh.lamp = table.lamp;
+    mesh.book = table.book;
+    mesh.sphereHandle = table.sphere;
+    mesh.shapeHandles[std::pair<int, uint>(SHAPE_SPHERE, table.sphereTesselation)] = table.sphere;
+
+    UUploadMeshes(mesh); // creates the VAO, nothing is pending
+    UAppendMeshData(mesh, (const MeshVertex*)pack.data(*vertices), nVertices, (const GLuint*)pack.data(*indices), nIndices);
+    return true;
+}
+
+
+// Source of a shader program stage: the asset pack's copy when it has one, otherwise the built-in source
+const char* UShaderSource(const char* name, const char* builtIn)
+{
+    const AssetPackEntry* packed = gAssetPack.isOpen() ? gAssetPack.find(name, ASSET_SHADER) : nullptr;
+    if (!packed || packed->size == 0 || gAssetPack.data(*packed)[packed->size - 1] != '\0')
+        return builtIn;
+    return (const char*)gAssetPack.data(*packed);
+}
+
+
+// Creates the uniform buffer behind the FrameData block and binds it to its binding point
+void UCreateFrameUniforms(GLuint& ubo)
+{
+    glGenBuffers(1, &ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORM_BINDING, ubo);
+}
+
+
+// Computes the camera matrices and view frustum for the current frame
+void UBuildFrameContext(FrameContext& frame)
+{
+    frame.view = gCamera.GetViewMatrix();
+
+    //Orthographic View option
+    if (orthoView) {
+        GLfloat oWidth = (GLfloat)WINDOW_WIDTH * 0.01f; // 10% of width
+        GLfloat oHeight = (GLfloat)WINDOW_HEIGHT * 0.01f; // 10% of height
+
+        frame.projection = glm::ortho(-oWidth, oWidth, oHeight, -oHeight, Z_NEAR, Z_FAR);
+    }
+    // camera/view transformation
+    else {
+        frame.projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, Z_NEAR, Z_FAR);
     }
 
-    // Error loading the image
-    return false;
+    frame.viewProjection = frame.projection * frame.view;
+    frame.cameraPosition = gCamera.Position;
+    frame.frustum = Camera::ExtractFrustum(frame.viewProjection);
+}
+
+
+// Writes this frame's camera and light state, shared by every object drawn in the frame
+void UUpdateFrameUniforms(GLuint ubo, const FrameContext& frame)
+{
+    FrameUniforms uniforms;
+    uniforms.view = frame.view;
+    uniforms.projection = frame.projection;
+    uniforms.lightColor = glm::vec4(gLightColor, 1.0f);
+    uniforms.lightPos = glm::vec4(gLightPosition, 1.0f);
+    uniforms.viewPosition = glm::vec4(frame.cameraPosition, 1.0f);
+
+    gGLState.bindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &uniforms);
 }
 
 
-void UDestroyTexture(GLuint textureId)
+void UDestroyFrameUniforms(GLuint ubo)
 {
-    glGenTextures(1, &textureId);
+    glDeleteBuffers(1, &ubo);
 }
 
 
 // Implements the UCreateShaders function
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId)
+bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, ShaderProgram& program)
 {
+    CPU_PROFILE_FUNCTION();
     // Compilation and linkage error reporting
     int success = 0;
     char infoLog[512];
 
     // Create a Shader program object.
-    programId = glCreateProgram();
+    GLuint programId = glCreateProgram();
+    program.id = programId;
 
     // Create the vertex and fragment shader objects
     GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
@@ -1581,14 +2227,41 @@ bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSou
         return false;
     }
 
+    // Resolve the uniform locations once, so rendering never looks them up by name
+    for (int i = 0; i < UNIFORM_COUNT; ++i)
+        program.uniforms[i] = -1;
+
+    GLint activeUniforms = 0;
+    glGetProgramiv(programId, GL_ACTIVE_UNIFORMS, &activeUniforms);
+    for (GLint i = 0; i < activeUniforms; ++i)
+    {
+        char name[64];
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(programId, (GLuint)i, sizeof(name), NULL, &size, &type, name);
+
+        // Arrays are reported as "name[0]"
+        if (char* bracket = strchr(name, '['))
+            *bracket = '\0';
+
+        for (int u = 0; u < UNIFORM_COUNT; ++u)
+        {
+            if (strcmp(name, UNIFORM_NAMES[u]) == 0)
+            {
+                program.uniforms[u] = glGetUniformLocation(programId, name);
+                break;
+            }
+        }
+    }
+
     glUseProgram(programId);    // Uses the shader program
 
     return true;
 }
 
 
-void UDestroyShaderProgram(GLuint programId)
+void UDestroyShaderProgram(ShaderProgram& program)
 {
-    glDeleteProgram(programId);
+    glDeleteProgram(program.id);
 }
 
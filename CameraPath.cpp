@@ -0,0 +1,134 @@
+#include "CameraPath.h"
+#include <cstdio>
+#include <cstring>
+
+static const char PATH_MAGIC[4] = { 'C', 'P', 'T', 'H' };
+static const uint32_t PATH_VERSION = 1;
+
+// On-disk layout of one pose
+struct PoseRecord
+{
+	float time;
+	float position[3];
+	float yaw;
+	float pitch;
+	float zoom;
+	uint32_t flags;
+};
+
+void CameraPath::record(float time, const Camera& camera, bool orthographic)
+{
+	CameraPose pose;
+	pose.time = time;
+	pose.position = camera.Position;
+	pose.yaw = camera.Yaw;
+	pose.pitch = camera.Pitch;
+	pose.zoom = camera.Zoom;
+	pose.flags = orthographic ? CameraPose::ORTHOGRAPHIC : 0;
+	poses.push_back(pose);
+}
+
+bool CameraPath::save(const char* path) const
+{
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		return false;
+
+	uint32_t count = (uint32_t)poses.size();
+	bool ok = fwrite(PATH_MAGIC, sizeof(PATH_MAGIC), 1, file) == 1
+		&& fwrite(&PATH_VERSION, sizeof(PATH_VERSION), 1, file) == 1
+		&& fwrite(&count, sizeof(count), 1, file) == 1;
+
+	for (size_t i = 0; ok && i < poses.size(); ++i)
+	{
+		const CameraPose& pose = poses[i];
+		PoseRecord record;
+		record.time = pose.time;
+		record.position[0] = pose.position.x;
+		record.position[1] = pose.position.y;
+		record.position[2] = pose.position.z;
+		record.yaw = pose.yaw;
+		record.pitch = pose.pitch;
+		record.zoom = pose.zoom;
+		record.flags = pose.flags;
+		ok = fwrite(&record, sizeof(record), 1, file) == 1;
+	}
+
+	return fclose(file) == 0 && ok;
+}
+
+bool CameraPath::load(const char* path)
+{
+	poses.clear();
+
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		return false;
+
+	char magic[4];
+	uint32_t version = 0;
+	uint32_t count = 0;
+	bool ok = fread(magic, sizeof(magic), 1, file) == 1
+		&& memcmp(magic, PATH_MAGIC, sizeof(magic)) == 0
+		&& fread(&version, sizeof(version), 1, file) == 1
+		&& version == PATH_VERSION
+		&& fread(&count, sizeof(count), 1, file) == 1;
+
+	for (uint32_t i = 0; ok && i < count; ++i)
+	{
+		PoseRecord record;
+		ok = fread(&record, sizeof(record), 1, file) == 1;
+		if (!ok)
+			break;
+
+		CameraPose pose;
+		pose.time = record.time;
+		pose.position = glm::vec3(record.position[0], record.position[1], record.position[2]);
+		pose.yaw = record.yaw;
+		pose.pitch = record.pitch;
+		pose.zoom = record.zoom;
+		pose.flags = record.flags;
+		poses.push_back(pose);
+	}
+
+	fclose(file);
+	if (!ok)
+		poses.clear();
+	return ok;
+}
+
+CameraPose CameraPath::sample(float time) const
+{
+	if (poses.empty())
+		return CameraPose();
+	if (time <= poses.front().time)
+		return poses.front();
+	if (time >= poses.back().time)
+		return poses.back();
+
+	// First pose after the time; poses are recorded in time order
+	size_t low = 0;
+	size_t high = poses.size() - 1;
+	while (high - low > 1)
+	{
+		size_t middle = (low + high) / 2;
+		if (poses[middle].time <= time)
+			low = middle;
+		else
+			high = middle;
+	}
+
+	const CameraPose& a = poses[low];
+	const CameraPose& b = poses[high];
+	float span = b.time - a.time;
+	float t = span > 0.0f ? (time - a.time) / span : 0.0f;
+
+	CameraPose ret;
+	ret.time = time;
+	ret.position = a.position + (b.position - a.position) * t;
+	ret.yaw = a.yaw + (b.yaw - a.yaw) * t;
+	ret.pitch = a.pitch + (b.pitch - a.pitch) * t;
+	ret.zoom = a.zoom + (b.zoom - a.zoom) * t;
+	ret.flags = a.flags;            // discrete state switches at the recorded frame
+	return ret;
+}
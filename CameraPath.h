@@ -0,0 +1,41 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "camera.h"
+#include <vector>
+#include <cstdint>
+
+// One recorded camera state
+struct CameraPose
+{
+	enum Flags { ORTHOGRAPHIC = 1 };
+
+	float time;                      // Seconds since the recording started
+	glm::vec3 position;
+	float yaw;
+	float pitch;
+	float zoom;
+	uint32_t flags;
+};
+
+// Camera poses recorded once per frame, saved to and loaded from a compact binary file:
+// a 12-byte header ("CPTH", version, pose count) then 32 bytes per pose, in the
+// byte order of the machine that recorded it (little-endian on every platform the renderer targets).
+// Replays sample the path at their own fixed time step, independent of the recording's frame rate.
+class CameraPath
+{
+	std::vector<CameraPose> poses;
+
+public:
+	void clear() { poses.clear(); }
+	void record(float time, const Camera& camera, bool orthographic);
+
+	bool save(const char* path) const;
+	bool load(const char* path);
+
+	// Pose at a time, interpolated between the two nearest recorded poses and clamped to the path's ends
+	CameraPose sample(float time) const;
+
+	size_t size() const { return poses.size(); }
+	float duration() const { return poses.empty() ? 0.0f : poses.back().time; }
+};
@@ -0,0 +1,132 @@
+#include "DecodeArena.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+DecodeArena::ThreadArena::ThreadArena()
+	: current(0), used(0), last(0), depth(0)
+{
+}
+
+DecodeArena::ThreadArena::~ThreadArena()
+{
+	for (size_t i = 0; i < blocks.size(); ++i)
+		free(blocks[i].allocation);
+}
+
+DecodeArena::ThreadArena& DecodeArena::local()
+{
+	static thread_local ThreadArena arena;
+	return arena;
+}
+
+bool DecodeArena::owns(const ThreadArena& arena, const void* memory)
+{
+	const unsigned char* bytes = (const unsigned char*)memory;
+	for (size_t i = 0; i < arena.blocks.size(); ++i)
+		if (bytes >= arena.blocks[i].memory && bytes < arena.blocks[i].memory + arena.blocks[i].size)
+			return true;
+	return false;
+}
+
+DecodeArena::Scope::Scope()
+{
+	++local().depth;
+}
+
+DecodeArena::Scope::~Scope()
+{
+	ThreadArena& arena = local();
+	if (--arena.depth == 0)
+	{
+		arena.current = 0;
+		arena.used = 0;
+		arena.last = 0;
+	}
+}
+
+void* DecodeArena::allocate(size_t size)
+{
+	ThreadArena& arena = local();
+	if (arena.depth == 0)
+		return malloc(size);
+
+	size_t offset = (arena.used + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+	if (arena.blocks.empty() || offset + size > arena.blocks[arena.current].size)
+	{
+		// Move on to the next block big enough, adding one after the last when none is
+		size_t next = arena.blocks.empty() ? 0 : arena.current + 1;
+		while (next < arena.blocks.size() && arena.blocks[next].size < size)
+			++next;
+		if (next == arena.blocks.size())
+		{
+			Block block;
+			block.size = std::max((size_t)BLOCK_SIZE, (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1));
+			block.allocation = malloc(block.size + ALIGNMENT);
+			if (!block.allocation)
+				return 0;
+			block.memory = (unsigned char*)(((size_t)block.allocation + ALIGNMENT - 1) & ~(ALIGNMENT - 1));
+			arena.blocks.push_back(block);
+		}
+		arena.current = next;
+		offset = 0;
+	}
+
+	arena.last = arena.blocks[arena.current].memory + offset;
+	arena.used = offset + size;
+	return arena.last;
+}
+
+void* DecodeArena::reallocate(void* memory, size_t oldSize, size_t newSize)
+{
+	ThreadArena& arena = local();
+	if (!memory)
+		return allocate(newSize);
+	if (!owns(arena, memory))
+		return realloc(memory, newSize);
+
+	// The latest allocation grows or shrinks where it is when its block has room
+	const Block& block = arena.blocks[arena.current];
+	if (memory == arena.last && (size_t)(arena.last - block.memory) + newSize <= block.size)
+	{
+		arena.used = (size_t)(arena.last - block.memory) + newSize;
+		return memory;
+	}
+
+	void* moved = allocate(newSize);
+	if (moved)
+		memcpy(moved, memory, std::min(oldSize, newSize));
+	return moved;
+}
+
+void DecodeArena::release(void* memory)
+{
+	ThreadArena& arena = local();
+	if (!memory)
+		return;
+	if (!owns(arena, memory))
+	{
+		free(memory);
+		return;
+	}
+
+	// Only the latest allocation is given back early; the rest goes when the scope closes
+	if (memory == arena.last)
+	{
+		arena.used = (size_t)(arena.last - arena.blocks[arena.current].memory);
+		arena.last = 0;
+	}
+}
+
+void DecodeArena::trim()
+{
+	ThreadArena& arena = local();
+	if (arena.depth > 0)
+		return;
+	for (size_t i = 0; i < arena.blocks.size(); ++i)
+		free(arena.blocks[i].allocation);
+	arena.blocks.clear();
+	arena.current = 0;
+	arena.used = 0;
+	arena.last = 0;
+}
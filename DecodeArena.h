@@ -0,0 +1,52 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+
+// Per-thread bump allocator behind stb_image's STBI_MALLOC, STBI_REALLOC_SIZED and STBI_FREE.
+// While a Scope is open on a thread, stb_image's working memory (JPEG component planes and line
+// buffers, PNG inflate and filter buffers) comes from that thread's arena, and all of it is
+// released at once when the outermost Scope closes. The blocks stay with the thread, so the next
+// image allocates nothing, until trim(). Outside a Scope the calls go to malloc, realloc and free.
+// Nothing allocated inside a Scope may outlive it: decode with the stbi_load_into functions there.
+class DecodeArena
+{
+	static const size_t BLOCK_SIZE = 4 << 20;
+	static const size_t ALIGNMENT = 64;
+
+	struct Block
+	{
+		void* allocation;
+		unsigned char* memory;   // allocation rounded up to ALIGNMENT
+		size_t size;
+	};
+
+	struct ThreadArena
+	{
+		std::vector<Block> blocks;
+		size_t current;        // block being filled
+		size_t used;           // bytes of it in use
+		unsigned char* last;   // latest allocation, which can grow or be given back in place
+		int depth;             // open scopes
+
+		ThreadArena();
+		~ThreadArena();
+	};
+
+	static ThreadArena& local();
+	static bool owns(const ThreadArena& arena, const void* memory);
+
+public:
+	class Scope
+	{
+	public:
+		Scope();
+		~Scope();
+	};
+
+	static void* allocate(size_t size);
+	static void* reallocate(void* memory, size_t oldSize, size_t newSize);
+	static void release(void* memory);
+
+	// Frees the calling thread's blocks; for threads going idle
+	static void trim();
+};
@@ -0,0 +1,40 @@
+#include "FileUtils.h"
+#include <cstdio>
+
+bool FileUtils::exists(const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		return false;
+	fclose(file);
+	return true;
+}
+
+bool FileUtils::size(const char* path, size_t& bytes)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		return false;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fclose(file);
+	bytes = size > 0 ? (size_t)size : 0;
+	return size > 0;
+}
+
+bool FileUtils::readAll(const char* path, std::vector<unsigned char>& contents)
+{
+	contents.clear();
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		return false;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	contents.resize(size > 0 ? (size_t)size : 0);
+	bool ok = size > 0 && fread(contents.data(), 1, contents.size(), file) == contents.size();
+	fclose(file);
+	if (!ok)
+		contents.clear();
+	return ok;
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+// Whole-file reads shared by the renderer, the texture loader and the standalone tools
+class FileUtils
+{
+public:
+	static bool exists(const char* path);
+
+	// Size of the file in bytes, without reading it. False when it can't be opened or is empty.
+	static bool size(const char* path, size_t& bytes);
+
+	// Reads the whole file into contents. False when it can't be opened or read, or is empty.
+	static bool readAll(const char* path, std::vector<unsigned char>& contents);
+};
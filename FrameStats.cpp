@@ -0,0 +1,185 @@
+#include "FrameStats.h"
+#include <cstdio>
+#include <cstring>
+
+static const double REPORTED_PERCENTILES[] = { 50.0, 90.0, 99.0, 99.9 };
+static const int NUM_REPORTED_PERCENTILES = sizeof(REPORTED_PERCENTILES) / sizeof(REPORTED_PERCENTILES[0]);
+
+FrameTimeHistogram::FrameTimeHistogram()
+{
+	reset();
+}
+
+void FrameTimeHistogram::reset()
+{
+	memset(counts, 0, sizeof(counts));
+	total = 0;
+	maxValue = 0;
+	sum = 0.0;
+}
+
+int FrameTimeHistogram::bucketIndex(uint64_t microseconds)
+{
+	if (microseconds < LINEAR_BUCKETS)
+		return (int)microseconds;
+
+	// Shift that brings the value into [SUB_BUCKETS, 2 * SUB_BUCKETS)
+	int shift = 1;
+	while ((microseconds >> shift) >= 2 * SUB_BUCKETS)
+		++shift;
+	if (shift > MAX_SHIFT)
+		return BUCKET_COUNT - 1;
+	return LINEAR_BUCKETS + (shift - 1) * SUB_BUCKETS + (int)((microseconds >> shift) - SUB_BUCKETS);
+}
+
+uint64_t FrameTimeHistogram::bucketLow(int index)
+{
+	if (index < LINEAR_BUCKETS)
+		return (uint64_t)index;
+	int shift = (index - LINEAR_BUCKETS) / SUB_BUCKETS + 1;
+	return (uint64_t)((index - LINEAR_BUCKETS) % SUB_BUCKETS + SUB_BUCKETS) << shift;
+}
+
+uint64_t FrameTimeHistogram::bucketHigh(int index)
+{
+	if (index < LINEAR_BUCKETS)
+		return (uint64_t)index + 1;
+	int shift = (index - LINEAR_BUCKETS) / SUB_BUCKETS + 1;
+	return bucketLow(index) + ((uint64_t)1 << shift);
+}
+
+void FrameTimeHistogram::record(uint64_t microseconds)
+{
+	++counts[bucketIndex(microseconds)];
+	++total;
+	sum += (double)microseconds;
+	if (microseconds > maxValue)
+		maxValue = microseconds;
+}
+
+double FrameTimeHistogram::percentileMs(double percentile) const
+{
+	if (total == 0)
+		return 0.0;
+
+	uint64_t rank = (uint64_t)(percentile / 100.0 * total + 0.5);
+	if (rank < 1)
+		rank = 1;
+
+	uint64_t seen = 0;
+	for (int i = 0; i < BUCKET_COUNT; ++i)
+	{
+		seen += counts[i];
+		if (seen >= rank)
+		{
+			uint64_t high = bucketHigh(i);
+			return (high < maxValue ? high : maxValue) / 1000.0;
+		}
+	}
+	return maxMs();
+}
+
+FrameStats::FrameStats() : stallCount(0), frames(0)
+{
+}
+
+void FrameStats::recordFrame(double cpuMs, double totalMs)
+{
+	cpu.record((uint64_t)(cpuMs * 1000.0 + 0.5));
+	total.record((uint64_t)(totalMs * 1000.0 + 0.5));
+
+	// Insert into the longest-first stall list if it beats the shortest kept stall
+	if (stallCount < WORST_STALLS || totalMs > stalls[stallCount - 1].totalMs)
+	{
+		int slot = stallCount < WORST_STALLS ? stallCount++ : WORST_STALLS - 1;
+		while (slot > 0 && stalls[slot - 1].totalMs < totalMs)
+		{
+			stalls[slot] = stalls[slot - 1];
+			--slot;
+		}
+		stalls[slot].frame = frames;
+		stalls[slot].totalMs = totalMs;
+		stalls[slot].cpuMs = cpuMs;
+	}
+	++frames;
+}
+
+void FrameStats::recordGpu(double gpuMs)
+{
+	gpu.record((uint64_t)(gpuMs * 1000.0 + 0.5));
+}
+
+void FrameStats::print(std::ostream& out) const
+{
+	const char* names[] = { "CPU", "GPU", "Total" };
+	const FrameTimeHistogram* histograms[] = { &cpu, &gpu, &total };
+
+	out << "INFO: Frame times over " << frames << " frames (ms):" << std::endl;
+	for (int h = 0; h < 3; ++h)
+	{
+		out << "    " << names[h] << ": avg " << histograms[h]->averageMs();
+		for (int p = 0; p < NUM_REPORTED_PERCENTILES; ++p)
+			out << ", p" << REPORTED_PERCENTILES[p] << " " << histograms[h]->percentileMs(REPORTED_PERCENTILES[p]);
+		out << ", max " << histograms[h]->maxMs() << std::endl;
+	}
+
+	out << "    Longest frames:";
+	for (int i = 0; i < stallCount; ++i)
+		out << " #" << stalls[i].frame << " " << stalls[i].totalMs << " (cpu " << stalls[i].cpuMs << ")";
+	out << std::endl;
+}
+
+bool FrameStats::writeCsv(const char* path) const
+{
+	FILE* file = fopen(path, "w");
+	if (!file)
+		return false;
+
+	const char* names[] = { "cpu", "gpu", "total" };
+	const FrameTimeHistogram* histograms[] = { &cpu, &gpu, &total };
+
+	fprintf(file, "metric,low_us,high_us,count\n");
+	for (int h = 0; h < 3; ++h)
+	{
+		for (int i = 0; i < FrameTimeHistogram::BUCKET_COUNT; ++i)
+		{
+			uint32_t count = histograms[h]->bucketCount(i);
+			if (count)
+			{
+				fprintf(file, "%s,%llu,%llu,%u\n", names[h], (unsigned long long)FrameTimeHistogram::bucketLow(i),
+					(unsigned long long)FrameTimeHistogram::bucketHigh(i), count);
+			}
+		}
+	}
+	return fclose(file) == 0;
+}
+
+bool FrameStats::writeJson(const char* path) const
+{
+	FILE* file = fopen(path, "w");
+	if (!file)
+		return false;
+
+	const char* names[] = { "cpu", "gpu", "total" };
+	const FrameTimeHistogram* histograms[] = { &cpu, &gpu, &total };
+
+	fprintf(file, "{\n  \"frames\": %llu,\n", (unsigned long long)frames);
+	for (int h = 0; h < 3; ++h)
+	{
+		const FrameTimeHistogram& histogram = *histograms[h];
+		fprintf(file, "  \"%s\": { \"samples\": %llu, \"avgMs\": %.4f, \"maxMs\": %.4f", names[h],
+			(unsigned long long)histogram.count(), histogram.averageMs(), histogram.maxMs());
+		for (int p = 0; p < NUM_REPORTED_PERCENTILES; ++p)
+			fprintf(file, ", \"p%g\": %.4f", REPORTED_PERCENTILES[p], histogram.percentileMs(REPORTED_PERCENTILES[p]));
+		fprintf(file, " },\n");
+	}
+
+	fprintf(file, "  \"stalls\": [");
+	for (int i = 0; i < stallCount; ++i)
+	{
+		fprintf(file, "%s\n    { \"frame\": %llu, \"totalMs\": %.4f, \"cpuMs\": %.4f }", i == 0 ? "" : ",",
+			(unsigned long long)stalls[i].frame, stalls[i].totalMs, stalls[i].cpuMs);
+	}
+	fprintf(file, "\n  ]\n}\n");
+	return fclose(file) == 0;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <ostream>
+#include <cstdint>
+
+// Fixed-size log-linear histogram of durations in microseconds (HdrHistogram layout): values below
+// 128 us have their own bucket, larger values share 64 linear buckets per power of two, so every
+// bucket is within ~1.6% of the values it holds. Values above ~38 hours are clamped into the last bucket.
+class FrameTimeHistogram
+{
+public:
+	static const int LINEAR_BUCKETS = 128;
+	static const int SUB_BUCKETS = 64;
+	static const int MAX_SHIFT = 30;
+	static const int BUCKET_COUNT = LINEAR_BUCKETS + MAX_SHIFT * SUB_BUCKETS;
+
+private:
+	uint32_t counts[BUCKET_COUNT];
+	uint64_t total;
+	uint64_t maxValue;
+	double sum;
+
+public:
+	FrameTimeHistogram();
+
+	void reset();
+	void record(uint64_t microseconds);
+
+	static int bucketIndex(uint64_t microseconds);
+	static uint64_t bucketLow(int index);
+	static uint64_t bucketHigh(int index);   // exclusive
+
+	// Smallest recorded bucket covering the percentile, reported at the bucket's upper edge (never under-reports)
+	double percentileMs(double percentile) const;
+	double averageMs() const { return total ? sum / total / 1000.0 : 0.0; }
+	double maxMs() const { return maxValue / 1000.0; }
+	uint64_t count() const { return total; }
+	uint32_t bucketCount(int index) const { return counts[index]; }
+};
+
+// Longest frames seen, kept with the frame number so hitches can be found in traces and replays
+struct FrameStall
+{
+	uint64_t frame;
+	double totalMs;
+	double cpuMs;
+};
+
+// CPU, GPU and total frame time histograms with tail percentiles and the worst stalls
+class FrameStats
+{
+public:
+	static const int WORST_STALLS = 8;
+
+private:
+	FrameTimeHistogram cpu;
+	FrameTimeHistogram gpu;
+	FrameTimeHistogram total;
+	FrameStall stalls[WORST_STALLS]; // longest first
+	int stallCount;
+	uint64_t frames;
+
+public:
+	FrameStats();
+
+	// cpuMs: CPU work of the frame before presenting; totalMs: wall time of the whole frame
+	void recordFrame(double cpuMs, double totalMs);
+	// GPU times arrive a few frames late from the timer queries, so they are recorded separately
+	void recordGpu(double gpuMs);
+
+	void print(std::ostream& out) const;
+	bool writeCsv(const char* path) const;  // one row per non-empty histogram bucket
+	bool writeJson(const char* path) const; // percentiles and stalls
+};
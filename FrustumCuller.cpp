@@ -0,0 +1,151 @@
+#include "FrustumCuller.h"
+#include <cmath>
+#include <algorithm>
+
+// Widest instruction set enabled for this build (/arch:AVX or -mavx for the 8-wide path)
+#if defined(__AVX__)
+#include <immintrin.h>
+#define CULL_LANES 8
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define CULL_LANES 4
+#else
+#define CULL_LANES 1
+#endif
+
+FrustumCuller::FrustumCuller()
+{
+	clear();
+}
+
+void FrustumCuller::clear()
+{
+	centerX.clear();
+	centerY.clear();
+	centerZ.clear();
+	extentX.clear();
+	extentY.clear();
+	extentZ.clear();
+	radius.clear();
+	visible.clear();
+	stats = FrustumCullStats();
+}
+
+uint32_t FrustumCuller::add(const BoundingVolume& bounds, const glm::mat4& model)
+{
+	// Box: transform the center, and project the half extents onto the world axes (Arvo's method)
+	glm::vec3 localCenter = (bounds.aabbMin + bounds.aabbMax) * 0.5f;
+	glm::vec3 localExtent = (bounds.aabbMax - bounds.aabbMin) * 0.5f;
+	glm::vec3 worldCenter = glm::vec3(model * glm::vec4(localCenter, 1.0f));
+	glm::vec3 worldExtent(0.0f);
+	for (int column = 0; column < 3; ++column)
+	{
+		for (int row = 0; row < 3; ++row)
+			worldExtent[row] += std::fabs(model[column][row]) * localExtent[column];
+	}
+
+	// Sphere: grown by the largest axis scale. BoundingVolume centers it on the box, so both share one position.
+	float scale = std::max(std::max(glm::length(glm::vec3(model[0])), glm::length(glm::vec3(model[1]))), glm::length(glm::vec3(model[2])));
+	float worldRadius = bounds.radius * scale;
+
+	centerX.push_back(worldCenter.x);
+	centerY.push_back(worldCenter.y);
+	centerZ.push_back(worldCenter.z);
+	extentX.push_back(worldExtent.x);
+	extentY.push_back(worldExtent.y);
+	extentZ.push_back(worldExtent.z);
+	radius.push_back(worldRadius);
+	return (uint32_t)(radius.size() - 1);
+}
+
+// An object is outside when it lies fully behind one plane. Its reach along the plane normal is
+// the smaller of the sphere radius and the box's projected radius: both enclose the object.
+void FrustumCuller::cullScalar(const Frustum& frustum, size_t first, size_t count)
+{
+	for (size_t i = first; i < count; ++i)
+	{
+		bool outside = false;
+		for (int p = 0; p < Frustum::PLANE_COUNT && !outside; ++p)
+		{
+			const glm::vec4& plane = frustum.planes[p];
+			float distance = plane.x * centerX[i] + plane.y * centerY[i] + plane.z * centerZ[i] + plane.w;
+			float boxRadius = std::fabs(plane.x) * extentX[i] + std::fabs(plane.y) * extentY[i] + std::fabs(plane.z) * extentZ[i];
+			float reach = boxRadius < radius[i] ? boxRadius : radius[i];
+			outside = distance + reach < 0.0f;
+		}
+		if (!outside)
+			visible.push_back((uint32_t)i);
+	}
+}
+
+void FrustumCuller::cull(const Frustum& frustum)
+{
+	const size_t count = radius.size();
+	visible.clear();
+	size_t i = 0;
+
+#if CULL_LANES == 8
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 cx = _mm256_loadu_ps(&centerX[i]);
+		__m256 cy = _mm256_loadu_ps(&centerY[i]);
+		__m256 cz = _mm256_loadu_ps(&centerZ[i]);
+		__m256 ex = _mm256_loadu_ps(&extentX[i]);
+		__m256 ey = _mm256_loadu_ps(&extentY[i]);
+		__m256 ez = _mm256_loadu_ps(&extentZ[i]);
+		__m256 r = _mm256_loadu_ps(&radius[i]);
+		__m256 outside = _mm256_setzero_ps();
+
+		for (int p = 0; p < Frustum::PLANE_COUNT; ++p)
+		{
+			const glm::vec4& plane = frustum.planes[p];
+			__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.x), cx), _mm256_mul_ps(_mm256_set1_ps(plane.y), cy)),
+				_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.z), cz), _mm256_set1_ps(plane.w)));
+			__m256 boxRadius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(std::fabs(plane.x)), ex), _mm256_mul_ps(_mm256_set1_ps(std::fabs(plane.y)), ey)),
+				_mm256_mul_ps(_mm256_set1_ps(std::fabs(plane.z)), ez));
+			__m256 reach = _mm256_min_ps(boxRadius, r);
+			outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, reach), _mm256_setzero_ps(), _CMP_LT_OQ));
+		}
+
+		int inside = ~_mm256_movemask_ps(outside) & 0xFF;
+		for (int lane = 0; lane < 8; ++lane)
+			if (inside & (1 << lane))
+				visible.push_back((uint32_t)(i + lane));
+	}
+#elif CULL_LANES == 4
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 cx = _mm_loadu_ps(&centerX[i]);
+		__m128 cy = _mm_loadu_ps(&centerY[i]);
+		__m128 cz = _mm_loadu_ps(&centerZ[i]);
+		__m128 ex = _mm_loadu_ps(&extentX[i]);
+		__m128 ey = _mm_loadu_ps(&extentY[i]);
+		__m128 ez = _mm_loadu_ps(&extentZ[i]);
+		__m128 r = _mm_loadu_ps(&radius[i]);
+		__m128 outside = _mm_setzero_ps();
+
+		for (int p = 0; p < Frustum::PLANE_COUNT; ++p)
+		{
+			const glm::vec4& plane = frustum.planes[p];
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), cx), _mm_mul_ps(_mm_set1_ps(plane.y), cy)),
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), cz), _mm_set1_ps(plane.w)));
+			__m128 boxRadius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(std::fabs(plane.x)), ex), _mm_mul_ps(_mm_set1_ps(std::fabs(plane.y)), ey)),
+				_mm_mul_ps(_mm_set1_ps(std::fabs(plane.z)), ez));
+			__m128 reach = _mm_min_ps(boxRadius, r);
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, reach), _mm_setzero_ps()));
+		}
+
+		int inside = ~_mm_movemask_ps(outside) & 0xF;
+		for (int lane = 0; lane < 4; ++lane)
+			if (inside & (1 << lane))
+				visible.push_back((uint32_t)(i + lane));
+	}
+#endif
+
+	// Objects left over after the last full register
+	cullScalar(frustum, i, count);
+
+	stats.tested = (uint32_t)count;
+	stats.visible = (uint32_t)visible.size();
+	stats.culled = stats.tested - stats.visible;
+}
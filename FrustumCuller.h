@@ -0,0 +1,46 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "BoundingVolume.h"
+#include "camera.h"
+#include <vector>
+#include <cstdint>
+
+// Objects tested and rejected by the last cull()
+struct FrustumCullStats
+{
+	uint32_t tested;
+	uint32_t visible;
+	uint32_t culled;
+};
+
+// Tests world-space object bounds against a view frustum, several objects per instruction.
+// Bounds are kept as structure-of-arrays (one array per component) so a SIMD register holds
+// the same component of 4 (SSE) or 8 (AVX) objects. Usage per frame: clear, add every object, cull.
+class FrustumCuller
+{
+	// World-space box (center and half extents) and sphere radius around the same center
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ;
+	std::vector<float> radius;
+
+	std::vector<uint32_t> visible;
+	FrustumCullStats stats;
+
+	void cullScalar(const Frustum& frustum, size_t first, size_t count);
+
+public:
+	FrustumCuller();
+
+	void clear();
+
+	// Adds an object from its object-space bounds and model matrix; returns its index
+	uint32_t add(const BoundingVolume& bounds, const glm::mat4& model);
+
+	// Fills the visible list with the indices, in ascending order, of the objects inside or crossing the frustum
+	void cull(const Frustum& frustum);
+
+	size_t size() const { return radius.size(); }
+	const std::vector<uint32_t>& getVisible() const { return visible; }
+	const FrustumCullStats& getStats() const { return stats; }
+};
@@ -0,0 +1,149 @@
+#include "GLStateCache.h"
+
+// Buffer targets and capabilities mirrored by the cache, others are always forwarded
+static const GLenum TRACKED_BUFFER_TARGETS[] = { GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER, GL_UNIFORM_BUFFER, GL_PIXEL_UNPACK_BUFFER, GL_DRAW_INDIRECT_BUFFER };
+static const GLenum TRACKED_CAPABILITIES[] = { GL_DEPTH_TEST, GL_CULL_FACE, GL_BLEND, GL_SCISSOR_TEST, GL_STENCIL_TEST };
+
+GLStateCache::GLStateCache()
+{
+	invalidate();
+	resetCounters();
+}
+
+void GLStateCache::invalidate()
+{
+	program = UNKNOWN;
+	vao = UNKNOWN;
+	activeUnit = UNKNOWN;
+	for (int i = 0; i < NUM_TEXTURE_UNITS; ++i)
+		textures2D[i] = UNKNOWN;
+	for (int i = 0; i < NUM_BUFFER_TARGETS; ++i)
+		buffers[i] = UNKNOWN;
+	for (int i = 0; i < NUM_CAPABILITIES; ++i)
+		capabilities[i] = UNKNOWN;
+}
+
+void GLStateCache::resetCounters()
+{
+	counters.issued = 0;
+	counters.elided = 0;
+}
+
+int GLStateCache::bufferSlot(GLenum target)
+{
+	for (int i = 0; i < NUM_BUFFER_TARGETS; ++i)
+		if (TRACKED_BUFFER_TARGETS[i] == target)
+			return i;
+	return -1;
+}
+
+int GLStateCache::capabilitySlot(GLenum capability)
+{
+	for (int i = 0; i < NUM_CAPABILITIES; ++i)
+		if (TRACKED_CAPABILITIES[i] == capability)
+			return i;
+	return -1;
+}
+
+void GLStateCache::useProgram(GLuint newProgram)
+{
+	if (program == newProgram)
+	{
+		++counters.elided;
+		return;
+	}
+	glUseProgram(newProgram);
+	program = newProgram;
+	++counters.issued;
+}
+
+void GLStateCache::bindVertexArray(GLuint newVao)
+{
+	if (vao == newVao)
+	{
+		++counters.elided;
+		return;
+	}
+	glBindVertexArray(newVao);
+	vao = newVao;
+	++counters.issued;
+
+	// The element buffer binding belongs to the VAO
+	buffers[bufferSlot(GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN;
+}
+
+void GLStateCache::activeTexture(GLenum unit)
+{
+	GLuint index = unit - GL_TEXTURE0;
+	if (activeUnit == index)
+	{
+		++counters.elided;
+		return;
+	}
+	glActiveTexture(unit);
+	activeUnit = index;
+	++counters.issued;
+}
+
+void GLStateCache::bindTexture(GLenum target, GLuint texture)
+{
+	bool tracked = target == GL_TEXTURE_2D && activeUnit < (GLuint)NUM_TEXTURE_UNITS;
+	if (tracked && textures2D[activeUnit] == texture)
+	{
+		++counters.elided;
+		return;
+	}
+	glBindTexture(target, texture);
+	if (tracked)
+		textures2D[activeUnit] = texture;
+	++counters.issued;
+}
+
+void GLStateCache::forgetTexture(GLuint texture)
+{
+	for (int i = 0; i < NUM_TEXTURE_UNITS; ++i)
+		if (textures2D[i] == texture)
+			textures2D[i] = 0;
+}
+
+void GLStateCache::bindBuffer(GLenum target, GLuint buffer)
+{
+	int slot = bufferSlot(target);
+	if (slot >= 0 && buffers[slot] == buffer)
+	{
+		++counters.elided;
+		return;
+	}
+	glBindBuffer(target, buffer);
+	if (slot >= 0)
+		buffers[slot] = buffer;
+	++counters.issued;
+}
+
+void GLStateCache::setCapability(GLenum capability, bool enabled)
+{
+	int slot = capabilitySlot(capability);
+	GLuint value = enabled ? GL_TRUE : GL_FALSE;
+	if (slot >= 0 && capabilities[slot] == value)
+	{
+		++counters.elided;
+		return;
+	}
+	if (enabled)
+		glEnable(capability);
+	else
+		glDisable(capability);
+	if (slot >= 0)
+		capabilities[slot] = value;
+	++counters.issued;
+}
+
+void GLStateCache::enable(GLenum capability)
+{
+	setCapability(capability, true);
+}
+
+void GLStateCache::disable(GLenum capability)
+{
+	setCapability(capability, false);
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <GL/glew.h>
+#include <cstdint>
+
+// CPU mirror of the GL bindings and enables the renderer touches every frame.
+// Calls that would not change the current state are dropped before they reach the driver.
+class GLStateCache
+{
+public:
+	// GL calls forwarded to the driver and calls dropped as no-ops
+	struct Counters
+	{
+		uint32_t issued;
+		uint32_t elided;
+	};
+
+private:
+	static const GLuint UNKNOWN = 0xFFFFFFFF;
+	static const int NUM_TEXTURE_UNITS = 16;
+	static const int NUM_BUFFER_TARGETS = 5;
+	static const int NUM_CAPABILITIES = 5;
+
+	GLuint program;
+	GLuint vao;
+	GLuint activeUnit;
+	GLuint textures2D[NUM_TEXTURE_UNITS];
+	GLuint buffers[NUM_BUFFER_TARGETS];
+	GLuint capabilities[NUM_CAPABILITIES];     // GL_TRUE, GL_FALSE or UNKNOWN
+	Counters counters;
+
+	static int bufferSlot(GLenum target);
+	static int capabilitySlot(GLenum capability);
+	void setCapability(GLenum capability, bool enabled);
+
+public:
+	GLStateCache();
+
+	// Forgets the mirrored state; call after GL state was changed without going through the cache
+	void invalidate();
+	void resetCounters();
+	const Counters& getCounters() const { return counters; }
+
+	void useProgram(GLuint newProgram);
+	void bindVertexArray(GLuint newVao);
+	void activeTexture(GLenum unit);
+	void bindTexture(GLenum target, GLuint texture);
+	// Call when deleting a texture: GL unbinds it, and the name may be handed out again
+	void forgetTexture(GLuint texture);
+	void bindBuffer(GLenum target, GLuint buffer);
+	void enable(GLenum capability);
+	void disable(GLenum capability);
+};
@@ -0,0 +1,207 @@
+#include "GPUProfiler.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+GPUProfiler::GPUProfiler() : current(0), framesCollected(0), framesDropped(0)
+{
+	for (int i = 0; i < FRAME_LATENCY; ++i)
+		frames[i].used = 0;
+}
+
+uint32_t GPUProfiler::sectionIndex(const char* name)
+{
+	for (size_t i = 0; i < sections.size(); ++i)
+		if (sections[i].name == name || strcmp(sections[i].name, name) == 0)
+			return (uint32_t)i;
+
+	Section section;
+	section.name = name;
+	section.next = 0;
+	section.fresh = false;
+	sections.push_back(section);
+	return (uint32_t)(sections.size() - 1);
+}
+
+GLuint GPUProfiler::acquireQuery(Frame& frame)
+{
+	if (frame.used == frame.queries.size())
+	{
+		GLuint query;
+		glGenQueries(1, &query);
+		frame.queries.push_back(query);
+	}
+	return frame.queries[frame.used++];
+}
+
+// Reads a finished frame's timings, unless the GPU has not reached its last query yet
+void GPUProfiler::collect(Frame& frame)
+{
+	if (frame.timings.empty())
+		return;
+
+	// Queries complete in submission order, so the last one issued covers the whole frame
+	GLint available = 0;
+	glGetQueryObjectiv(frame.queries[frame.used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+	{
+		++framesDropped;
+		return;
+	}
+
+	for (size_t i = 0; i < frame.timings.size(); ++i)
+	{
+		const Timing& timing = frame.timings[i];
+		GLuint64 beginTime = 0;
+		GLuint64 endTime = 0;
+		glGetQueryObjectui64v(timing.beginQuery, GL_QUERY_RESULT, &beginTime);
+		glGetQueryObjectui64v(timing.endQuery, GL_QUERY_RESULT, &endTime);
+
+		Section& section = sections[timing.section];
+		double ms = (endTime - beginTime) / 1000000.0;
+		if (section.samples.size() < SAMPLE_WINDOW)
+			section.samples.push_back(ms);
+		else
+			section.samples[section.next] = ms;
+		section.next = (section.next + 1) % SAMPLE_WINDOW;
+		section.fresh = true;
+	}
+	++framesCollected;
+}
+
+void GPUProfiler::beginFrame()
+{
+	current = (current + 1) % FRAME_LATENCY;
+	Frame& frame = frames[current];
+	collect(frame);
+	frame.used = 0;
+	frame.timings.clear();
+	open.clear();
+}
+
+void GPUProfiler::endFrame()
+{
+	// Sections left open would never get an end timestamp
+	while (!open.empty())
+		end();
+}
+
+void GPUProfiler::begin(const char* name)
+{
+	Frame& frame = frames[current];
+	Timing timing;
+	timing.section = sectionIndex(name);
+	timing.beginQuery = acquireQuery(frame);
+	timing.endQuery = 0;
+	glQueryCounter(timing.beginQuery, GL_TIMESTAMP);
+
+	open.push_back(frame.timings.size());
+	frame.timings.push_back(timing);
+}
+
+void GPUProfiler::end()
+{
+	if (open.empty())
+		return;
+
+	Frame& frame = frames[current];
+	Timing& timing = frame.timings[open.back()];
+	open.pop_back();
+	timing.endQuery = acquireQuery(frame);
+	glQueryCounter(timing.endQuery, GL_TIMESTAMP);
+}
+
+bool GPUProfiler::takeLatest(const char* name, double& ms)
+{
+	for (size_t i = 0; i < sections.size(); ++i)
+	{
+		Section& section = sections[i];
+		if (section.name != name && strcmp(section.name, name) != 0)
+			continue;
+		if (!section.fresh)
+			return false;
+
+		ms = section.samples[(section.next + SAMPLE_WINDOW - 1) % SAMPLE_WINDOW];
+		section.fresh = false;
+		return true;
+	}
+	return false;
+}
+
+void GPUProfiler::getStats(std::vector<SectionStats>& stats) const
+{
+	stats.clear();
+	std::vector<double> sorted;
+	for (size_t i = 0; i < sections.size(); ++i)
+	{
+		const Section& section = sections[i];
+		SectionStats entry;
+		entry.name = section.name;
+		entry.samples = (uint32_t)section.samples.size();
+		entry.averageMs = 0.0;
+		entry.p99Ms = 0.0;
+
+		if (!section.samples.empty())
+		{
+			sorted = section.samples;
+			std::sort(sorted.begin(), sorted.end());
+			double total = 0.0;
+			for (size_t s = 0; s < sorted.size(); ++s)
+				total += sorted[s];
+			entry.averageMs = total / sorted.size();
+
+			// Nearest-rank percentile
+			size_t rank = (size_t)(0.99 * sorted.size() + 0.5);
+			rank = rank < 1 ? 1 : (rank > sorted.size() ? sorted.size() : rank);
+			entry.p99Ms = sorted[rank - 1];
+		}
+		stats.push_back(entry);
+	}
+}
+
+void GPUProfiler::print(std::ostream& out) const
+{
+	std::vector<SectionStats> stats;
+	getStats(stats);
+
+	out << "INFO: GPU time per pass over the last " << SAMPLE_WINDOW << " frames (" << framesCollected
+		<< " frames collected, " << framesDropped << " dropped):" << std::endl;
+	for (size_t i = 0; i < stats.size(); ++i)
+	{
+		out << "    " << stats[i].name << ": avg " << stats[i].averageMs << " ms, p99 "
+			<< stats[i].p99Ms << " ms (" << stats[i].samples << " samples)" << std::endl;
+	}
+}
+
+bool GPUProfiler::writeJson(const char* path) const
+{
+	FILE* file = fopen(path, "w");
+	if (!file)
+		return false;
+
+	std::vector<SectionStats> stats;
+	getStats(stats);
+
+	fprintf(file, "{\n  \"framesCollected\": %u,\n  \"framesDropped\": %u,\n  \"passes\": [", framesCollected, framesDropped);
+	for (size_t i = 0; i < stats.size(); ++i)
+	{
+		fprintf(file, "%s\n    { \"name\": \"%s\", \"samples\": %u, \"avgMs\": %.6f, \"p99Ms\": %.6f }",
+			i == 0 ? "" : ",", stats[i].name, stats[i].samples, stats[i].averageMs, stats[i].p99Ms);
+	}
+	fprintf(file, "\n  ]\n}\n");
+	return fclose(file) == 0;
+}
+
+void GPUProfiler::destroy()
+{
+	for (int i = 0; i < FRAME_LATENCY; ++i)
+	{
+		Frame& frame = frames[i];
+		if (!frame.queries.empty())
+			glDeleteQueries((GLsizei)frame.queries.size(), frame.queries.data());
+		frame.queries.clear();
+		frame.timings.clear();
+		frame.used = 0;
+	}
+	open.clear();
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <GL/glew.h>
+#include <vector>
+#include <ostream>
+#include <cstdint>
+
+// Measures GPU time of named sections with GL_TIMESTAMP queries. Each frame's queries are
+// read back FRAME_LATENCY frames later; results still pending then are dropped rather than
+// waited on, so the profiler never stalls the pipeline. Sections may nest.
+class GPUProfiler
+{
+public:
+	// Rolling statistics of one section over its last SAMPLE_WINDOW frames
+	struct SectionStats
+	{
+		const char* name;
+		uint32_t samples;
+		double averageMs;
+		double p99Ms;
+	};
+
+private:
+	static const int FRAME_LATENCY = 4;
+	static const int SAMPLE_WINDOW = 240;
+
+	struct Section
+	{
+		const char* name;
+		std::vector<double> samples; // ring of the last SAMPLE_WINDOW times in ms
+		uint32_t next;
+		bool fresh;                  // newest sample not taken by takeLatest yet
+	};
+
+	// One begin/end pair issued during a frame
+	struct Timing
+	{
+		uint32_t section;
+		GLuint beginQuery;
+		GLuint endQuery;
+	};
+
+	struct Frame
+	{
+		std::vector<GLuint> queries; // reused every time the frame slot comes around
+		size_t used;
+		std::vector<Timing> timings;
+	};
+
+	Frame frames[FRAME_LATENCY];
+	uint32_t current;
+	std::vector<Section> sections;
+	std::vector<size_t> open;        // timings of the current frame still waiting for end()
+	uint32_t framesCollected;
+	uint32_t framesDropped;
+
+	uint32_t sectionIndex(const char* name);
+	GLuint acquireQuery(Frame& frame);
+	void collect(Frame& frame);
+
+public:
+	GPUProfiler();
+
+	void beginFrame();
+	void endFrame();
+
+	// Names are compared by pointer first, so pass string literals
+	void begin(const char* name);
+	void end();
+
+	// Newest sample of a section, only if it arrived since the previous call (e.g. to feed other statistics)
+	bool takeLatest(const char* name, double& ms);
+
+	void getStats(std::vector<SectionStats>& stats) const;
+	void print(std::ostream& out) const;
+	bool writeJson(const char* path) const;
+
+	// Deletes the query objects; call while the context is still current
+	void destroy();
+};
@@ -0,0 +1,97 @@
+// Measures JPEG decode time with each set of stb_image kernels (IDCT, YCbCr->RGB, 2x2 chroma upsampling):
+//   scalar   - the plain C kernels
+//   simd128  - SSE2 (NEON on ARM)
+//   simd256  - AVX2 where the CPU has it, picked at runtime; otherwise the same as simd128
+// Every image is decoded to RGBA from memory, so file reads stay out of the timings, and the
+// three decodes are checked to be identical byte for byte.
+//
+//   JpegDecodeBenchmark image.jpg...
+//
+// Build as its own executable from JpegDecodeBenchmark.cpp and FileUtils.cpp, for example:
+//   g++ -O2 -std=c++11 JpegDecodeBenchmark.cpp FileUtils.cpp -o JpegDecodeBenchmark && ./JpegDecodeBenchmark ContainerTexture.jpg
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include "FileUtils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+static const int RUNS = 9;
+static const int LEVELS = 3;
+
+// Median decode time in ms; the last decode is kept in pixels
+static double timeDecode(const std::vector<unsigned char>& file, int kernels, std::vector<unsigned char>& pixels, int& width, int& height)
+{
+	stbi_limit_jpeg_kernels(kernels);
+
+	std::vector<double> times;
+	for (int run = 0; run < RUNS; ++run)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		int channels;
+		unsigned char* image = stbi_load_from_memory(file.data(), (int)file.size(), &width, &height, &channels, 4);
+		if (!image)
+		{
+			printf("Decode failed: %s\n", stbi_failure_reason());
+			exit(EXIT_FAILURE);
+		}
+
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		pixels.assign(image, image + (size_t)width * height * 4);
+		stbi_image_free(image);
+		times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+	}
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		printf("usage: %s image.jpg...\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const char* labels[LEVELS] = { "scalar", "simd128", "simd256" };
+
+	bool identical = true;
+	printf("%-24s %11s %15s %15s %15s\n", "image", "size", labels[0], labels[1], labels[2]);
+	for (int i = 1; i < argc; ++i)
+	{
+		std::vector<unsigned char> file;
+		if (!FileUtils::readAll(argv[i], file))
+		{
+			printf("%s: can't read\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+
+		std::vector<unsigned char> pixels[LEVELS];
+		double ms[LEVELS];
+		int width = 0, height = 0;
+		for (int level = 0; level < LEVELS; ++level)
+			ms[level] = timeDecode(file, level, pixels[level], width, height);
+
+		char size[32];
+		snprintf(size, sizeof(size), "%dx%d", width, height);
+		double megapixels = (double)width * height / 1e6;
+		printf("%-24s %11s", argv[i], size);
+		for (int level = 0; level < LEVELS; ++level)
+			printf(" %6.1f ms %4.0fMP/s", ms[level], megapixels / (ms[level] / 1000.0));
+		printf("\n");
+
+		for (int level = 1; level < LEVELS; ++level)
+			if (pixels[level] != pixels[0])
+			{
+				printf("%s: %s decode differs from scalar\n", argv[i], labels[level]);
+				identical = false;
+			}
+	}
+	stbi_limit_jpeg_kernels(STBI_jpeg_simd256);
+	return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,234 @@
+#include "Ktx2File.h"
+#include <cstdio>
+#include <cstring>
+
+static const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+// Header and index that follow the identifier, all little-endian. The 64-bit fields follow
+// an odd number of 32-bit ones, so the struct is packed to keep them where the file has them.
+#pragma pack(push, 4)
+struct Ktx2Header
+{
+	uint32_t vkFormat;
+	uint32_t typeSize;
+	uint32_t pixelWidth;
+	uint32_t pixelHeight;
+	uint32_t pixelDepth;
+	uint32_t layerCount;
+	uint32_t faceCount;
+	uint32_t levelCount;
+	uint32_t supercompressionScheme;
+	uint32_t dfdByteOffset;
+	uint32_t dfdByteLength;
+	uint32_t kvdByteOffset;
+	uint32_t kvdByteLength;
+	uint64_t sgdByteOffset;
+	uint64_t sgdByteLength;
+};
+#pragma pack(pop)
+
+struct Ktx2LevelIndex
+{
+	uint64_t byteOffset;
+	uint64_t byteLength;
+	uint64_t uncompressedByteLength;
+};
+
+// Khronos data format descriptor values for the basic descriptor block
+enum
+{
+	KHR_DF_MODEL_RGBSDA = 1,
+	KHR_DF_MODEL_BC1A = 128,
+	KHR_DF_MODEL_BC3 = 130,
+	KHR_DF_PRIMARIES_BT709 = 1,
+	KHR_DF_TRANSFER_LINEAR = 1,
+	KHR_DF_TRANSFER_SRGB = 2,
+	KHR_DF_SAMPLE_DATATYPE_LINEAR = 0x10, // qualifier of alpha samples, which an sRGB transfer leaves linear
+	KHR_DF_CHANNEL_BC1A_COLOR = 0,
+	KHR_DF_CHANNEL_BC3_COLOR = 0,
+	KHR_DF_CHANNEL_BC3_ALPHA = 15,
+	KHR_DF_CHANNEL_RGBSDA_ALPHA = 15    // red, green and blue are channels 0, 1 and 2
+};
+
+bool Ktx2File::isKtx2(const unsigned char* data, size_t size)
+{
+	return size >= sizeof(KTX2_IDENTIFIER) && memcmp(data, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) == 0;
+}
+
+uint32_t Ktx2File::unormFormat(uint32_t vkFormat)
+{
+	switch (vkFormat)
+	{
+	case KTX2_FORMAT_R8G8B8_SRGB: return KTX2_FORMAT_R8G8B8_UNORM;
+	case KTX2_FORMAT_R8G8B8A8_SRGB: return KTX2_FORMAT_R8G8B8A8_UNORM;
+	case KTX2_FORMAT_BC1_RGB_SRGB: return KTX2_FORMAT_BC1_RGB_UNORM;
+	case KTX2_FORMAT_BC3_SRGB: return KTX2_FORMAT_BC3_UNORM;
+	default: return vkFormat;
+	}
+}
+
+uint32_t Ktx2File::blockBytes(uint32_t vkFormat)
+{
+	switch (unormFormat(vkFormat))
+	{
+	case KTX2_FORMAT_R8G8B8_UNORM: return 3;
+	case KTX2_FORMAT_R8G8B8A8_UNORM: return 4;
+	case KTX2_FORMAT_BC1_RGB_UNORM: return 8;
+	case KTX2_FORMAT_BC3_UNORM: return 16;
+	default: return 0;
+	}
+}
+
+uint32_t Ktx2File::blockDimension(uint32_t vkFormat)
+{
+	const uint32_t unorm = unormFormat(vkFormat);
+	return unorm == KTX2_FORMAT_BC1_RGB_UNORM || unorm == KTX2_FORMAT_BC3_UNORM ? 4 : 1;
+}
+
+uint64_t Ktx2File::levelSize(uint32_t vkFormat, uint32_t width, uint32_t height)
+{
+	const uint32_t dimension = blockDimension(vkFormat);
+	return (uint64_t)((width + dimension - 1) / dimension) * ((height + dimension - 1) / dimension) * blockBytes(vkFormat);
+}
+
+bool Ktx2File::parse(const unsigned char* data, size_t size, Ktx2Image& image)
+{
+	Ktx2Header header;
+	if (!isKtx2(data, size) || size < sizeof(KTX2_IDENTIFIER) + sizeof(header))
+		return false;
+	memcpy(&header, data + sizeof(KTX2_IDENTIFIER), sizeof(header));
+
+	if (blockBytes(header.vkFormat) == 0 || header.pixelWidth == 0 || header.pixelHeight == 0
+		|| header.pixelDepth != 0 || header.layerCount != 0 || header.faceCount != 1
+		|| header.levelCount == 0 || header.levelCount > 32 || header.supercompressionScheme != 0)
+		return false;
+
+	const size_t indexOffset = sizeof(KTX2_IDENTIFIER) + sizeof(header);
+	if (size < indexOffset + header.levelCount * sizeof(Ktx2LevelIndex))
+		return false;
+
+	image.vkFormat = header.vkFormat;
+	image.width = header.pixelWidth;
+	image.height = header.pixelHeight;
+	image.levels.resize(header.levelCount);
+	for (uint32_t i = 0; i < header.levelCount; ++i)
+	{
+		Ktx2LevelIndex index;
+		memcpy(&index, data + indexOffset + i * sizeof(index), sizeof(index));
+
+		Ktx2Level& level = image.levels[i];
+		level.width = header.pixelWidth >> i ? header.pixelWidth >> i : 1;
+		level.height = header.pixelHeight >> i ? header.pixelHeight >> i : 1;
+		level.offset = index.byteOffset;
+		level.size = index.byteLength;
+		if (level.size != levelSize(header.vkFormat, level.width, level.height) || level.offset > size || level.size > size - level.offset)
+			return false;
+	}
+	return true;
+}
+
+bool Ktx2File::serialize(uint32_t vkFormat, uint32_t width, uint32_t height, const std::vector<std::vector<unsigned char> >& levels, std::vector<unsigned char>& file)
+{
+	const uint32_t blockSize = blockBytes(vkFormat);
+	if (blockSize == 0 || levels.empty())
+		return false;
+	const uint32_t levelCount = (uint32_t)levels.size();
+
+	// Basic data format descriptor. Block-compressed formats have one 64-bit sample per plane,
+	// alpha then color for BC3; uncompressed ones one 8-bit sample per channel.
+	const bool compressed = isCompressed(vkFormat);
+	const bool bc3 = unormFormat(vkFormat) == KTX2_FORMAT_BC3_UNORM;
+	const bool srgb = isSrgb(vkFormat);
+	const uint32_t sampleCount = compressed ? (bc3 ? 2 : 1) : blockSize;
+	const uint32_t blockLength = 24 + 16 * sampleCount;
+	std::vector<unsigned char> dfd(4 + blockLength, 0);
+	uint32_t dfdTotal = (uint32_t)dfd.size();
+	uint16_t versionNumber = 2;
+	uint16_t descriptorBlockSize = (uint16_t)blockLength;
+	memcpy(&dfd[0], &dfdTotal, 4);
+	memcpy(&dfd[8], &versionNumber, 2);                 // bytes 4-7: vendor and descriptor type, both 0
+	memcpy(&dfd[10], &descriptorBlockSize, 2);
+	dfd[12] = !compressed ? KHR_DF_MODEL_RGBSDA : bc3 ? KHR_DF_MODEL_BC3 : KHR_DF_MODEL_BC1A;
+	dfd[13] = KHR_DF_PRIMARIES_BT709;
+	dfd[14] = srgb ? KHR_DF_TRANSFER_SRGB : KHR_DF_TRANSFER_LINEAR;
+	dfd[16] = (unsigned char)(blockDimension(vkFormat) - 1); // texel block dimensions minus one
+	dfd[17] = (unsigned char)(blockDimension(vkFormat) - 1);
+	dfd[20] = (unsigned char)blockSize;                 // bytes in plane 0
+	for (uint32_t s = 0; s < sampleCount; ++s)
+	{
+		unsigned char* sample = &dfd[28 + 16 * s];
+		uint16_t bitOffset = (uint16_t)((compressed ? 64 : 8) * s);
+		uint32_t upper = compressed ? 0xFFFFFFFF : 255;
+		memcpy(sample, &bitOffset, 2);
+		sample[2] = compressed ? 63 : 7;                // bit length minus one
+		const bool alpha = compressed ? bc3 && s == 0 : s == 3;
+		if (compressed)
+			sample[3] = alpha ? KHR_DF_CHANNEL_BC3_ALPHA : KHR_DF_CHANNEL_BC1A_COLOR;
+		else
+			sample[3] = alpha ? (unsigned char)KHR_DF_CHANNEL_RGBSDA_ALPHA : (unsigned char)s;
+		if (alpha && srgb)
+			sample[3] |= KHR_DF_SAMPLE_DATATYPE_LINEAR;
+		memcpy(sample + 12, &upper, 4);
+	}
+
+	Ktx2Header header;
+	memset(&header, 0, sizeof(header));
+	header.vkFormat = vkFormat;
+	header.typeSize = 1;
+	header.pixelWidth = width;
+	header.pixelHeight = height;
+	header.faceCount = 1;
+	header.levelCount = levelCount;
+	header.dfdByteOffset = (uint32_t)(sizeof(KTX2_IDENTIFIER) + sizeof(header) + levelCount * sizeof(Ktx2LevelIndex));
+	header.dfdByteLength = dfdTotal;
+
+	// Smallest level first, each starting on a multiple of both the block size and 4
+	uint32_t alignment = blockSize;
+	while (alignment % 4 != 0)
+		alignment += blockSize;
+	std::vector<Ktx2LevelIndex> index(levelCount);
+	uint64_t offset = header.dfdByteOffset + dfdTotal;
+	for (uint32_t i = levelCount; i-- > 0;)
+	{
+		offset = (offset + alignment - 1) / alignment * alignment;
+		index[i].byteOffset = offset;
+		index[i].byteLength = levels[i].size();
+		index[i].uncompressedByteLength = levels[i].size();
+		offset += levels[i].size();
+	}
+
+	// Padding between levels stays zero
+	file.assign((size_t)offset, 0);
+	unsigned char* out = file.data();
+	memcpy(out, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+	memcpy(out + sizeof(KTX2_IDENTIFIER), &header, sizeof(header));
+	memcpy(out + sizeof(KTX2_IDENTIFIER) + sizeof(header), index.data(), index.size() * sizeof(Ktx2LevelIndex));
+	memcpy(out + header.dfdByteOffset, dfd.data(), dfd.size());
+	for (uint32_t i = 0; i < levelCount; ++i)
+		if (!levels[i].empty())
+			memcpy(out + index[i].byteOffset, levels[i].data(), levels[i].size());
+	return true;
+}
+
+bool Ktx2File::write(const char* path, uint32_t vkFormat, uint32_t width, uint32_t height, const std::vector<std::vector<unsigned char> >& levels)
+{
+	std::vector<unsigned char> contents;
+	if (!serialize(vkFormat, width, height, levels, contents))
+		return false;
+
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		return false;
+	bool ok = fwrite(contents.data(), contents.size(), 1, file) == 1;
+	return fclose(file) == 0 && ok;
+}
+
+std::string Ktx2File::bakedPath(const char* source)
+{
+	std::string path = source;
+	size_t dot = path.find_last_of('.');
+	size_t slash = path.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return path + ".ktx2";
+	return path.substr(0, dot) + ".ktx2";
+}
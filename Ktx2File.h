@@ -0,0 +1,70 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Vulkan formats of the images TextureBaker writes (block-compressed) and asset packs hold (also pre-decoded).
+// Source images are sRGB-encoded, so both write the _SRGB formats. The renderer has no sRGB framebuffer
+// and lights the encoded values as they are, so it samples every format here as UNORM, the _SRGB ones
+// included; UNORM files from older bakes load the same way.
+enum Ktx2Format
+{
+	KTX2_FORMAT_R8G8B8_UNORM = 23,
+	KTX2_FORMAT_R8G8B8_SRGB = 29,
+	KTX2_FORMAT_R8G8B8A8_UNORM = 37,
+	KTX2_FORMAT_R8G8B8A8_SRGB = 43,
+	KTX2_FORMAT_BC1_RGB_UNORM = 131,
+	KTX2_FORMAT_BC1_RGB_SRGB = 132,
+	KTX2_FORMAT_BC3_UNORM = 137,
+	KTX2_FORMAT_BC3_SRGB = 138
+};
+
+// Where one mip level's data sits in the file
+struct Ktx2Level
+{
+	uint32_t width;
+	uint32_t height;
+	uint64_t offset;
+	uint64_t size;
+};
+
+struct Ktx2Image
+{
+	uint32_t vkFormat;
+	uint32_t width;
+	uint32_t height;
+	std::vector<Ktx2Level> levels;   // Level 0 is the full-size image
+};
+
+// Reads and writes the subset of KTX 2.0 used for baked textures: a single 2D image with
+// its mip chain, no array layers or cube faces, no supercompression and no key/value data.
+// Level data is stored smallest level first, each aligned to lcm(block size, 4), as the format requires.
+class Ktx2File
+{
+public:
+	static bool isKtx2(const unsigned char* data, size_t size);
+
+	// The UNORM format laid out like vkFormat, which is vkFormat itself unless it is an _SRGB one
+	static uint32_t unormFormat(uint32_t vkFormat);
+	static bool isSrgb(uint32_t vkFormat) { return unormFormat(vkFormat) != vkFormat; }
+
+	// Texel block of a supported format: 4x4 for block-compressed formats, a single texel otherwise.
+	// blockBytes() is 0 for anything else.
+	static uint32_t blockBytes(uint32_t vkFormat);
+	static uint32_t blockDimension(uint32_t vkFormat);
+	static bool isCompressed(uint32_t vkFormat) { return blockDimension(vkFormat) > 1; }
+	static uint64_t levelSize(uint32_t vkFormat, uint32_t width, uint32_t height);
+
+	// Validates the header and level index of a file held in memory; level offsets index into data
+	static bool parse(const unsigned char* data, size_t size, Ktx2Image& image);
+
+	// Builds a file in memory from the encoded levels, level 0 first
+	static bool serialize(uint32_t vkFormat, uint32_t width, uint32_t height, const std::vector<std::vector<unsigned char> >& levels, std::vector<unsigned char>& file);
+
+	// Same, written to path
+	static bool write(const char* path, uint32_t vkFormat, uint32_t width, uint32_t height, const std::vector<std::vector<unsigned char> >& levels);
+
+	// Where TextureBaker writes the KTX2 file of a source image: ContainerTexture.jpg -> ContainerTexture.ktx2
+	static std::string bakedPath(const char* source);
+};
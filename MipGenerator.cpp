@@ -0,0 +1,191 @@
+#include "MipGenerator.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+// Widest instruction set enabled for this build (/arch:AVX2 or -mavx2 include the 8-wide path)
+#if defined(__AVX__)
+#include <immintrin.h>
+#define MIP_LANES 8
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define MIP_LANES 4
+#else
+#define MIP_LANES 1
+#endif
+
+// sRGB <-> linear conversion tables. Linear values are re-encoded through a 16-bit index so
+// the darkest sRGB steps, which sit less than 1/4096 apart in linear light, survive the round trip.
+struct SrgbTables
+{
+	float toLinear[256];
+	unsigned char fromLinear[65536];
+
+	SrgbTables()
+	{
+		for (int i = 0; i < 256; ++i)
+		{
+			float s = i / 255.0f;
+			toLinear[i] = s <= 0.04045f ? s / 12.92f : std::pow((s + 0.055f) / 1.055f, 2.4f);
+		}
+		for (int i = 0; i < 65536; ++i)
+		{
+			float linear = i / 65535.0f;
+			float s = linear <= 0.0031308f ? linear * 12.92f : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+			fromLinear[i] = (unsigned char)std::min(255.0f, s * 255.0f + 0.5f);
+		}
+	}
+};
+
+static const SrgbTables& srgbTables()
+{
+	static const SrgbTables tables;
+	return tables;
+}
+
+// Channel holding alpha, -1 when there is none
+static int alphaChannel(int channels)
+{
+	return channels == 4 ? 3 : (channels == 2 ? 1 : -1);
+}
+
+static void decodeRow(const unsigned char* row, int pixels, int channels, float* linear)
+{
+	const SrgbTables& tables = srgbTables();
+	const int alpha = alphaChannel(channels);
+	const int colors = alpha < 0 ? channels : alpha;
+	for (int p = 0; p < pixels; ++p, row += channels, linear += channels)
+	{
+		for (int c = 0; c < colors; ++c)
+			linear[c] = tables.toLinear[row[c]];
+		if (alpha >= 0)
+			linear[alpha] = row[alpha] * (1.0f / 255.0f);
+	}
+}
+
+static void encodeRow(const float* linear, int pixels, int channels, unsigned char* row)
+{
+	const SrgbTables& tables = srgbTables();
+	const int alpha = alphaChannel(channels);
+	const int colors = alpha < 0 ? channels : alpha;
+	for (int p = 0; p < pixels; ++p, row += channels, linear += channels)
+	{
+		for (int c = 0; c < colors; ++c)
+			row[c] = tables.fromLinear[(int)(std::min(1.0f, std::max(0.0f, linear[c])) * 65535.0f + 0.5f)];
+		if (alpha >= 0)
+			row[alpha] = (unsigned char)(std::min(1.0f, std::max(0.0f, linear[alpha])) * 255.0f + 0.5f);
+	}
+}
+
+void MipGenerator::layout(int width, int height, int channels, std::vector<MipLevel>& levels)
+{
+	levels.clear();
+	for (;;)
+	{
+		MipLevel level;
+		level.width = width;
+		level.height = height;
+		level.size = (size_t)width * height * channels;
+		levels.push_back(level);
+		if (width == 1 && height == 1)
+			break;
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+	}
+}
+
+// Odd sizes round down; a missing right or bottom neighbour repeats the last column or row
+void MipGenerator::downsampleRows(const unsigned char* source, int sourceWidth, int sourceHeight, unsigned char* target, int width, int channels, int firstRow, int endRow)
+{
+	const int sourceCount = sourceWidth * channels;
+	const int count = width * channels;
+
+	// Padded so the 4-wide loads and stores of 3-channel pixels may run one float past the end
+	std::vector<float> top(sourceCount + 4), bottom(sourceCount + 4), sum(sourceCount + 4), result(count + 4);
+
+	for (int y = firstRow; y < endRow; ++y)
+	{
+		const int y0 = std::min(y * 2, sourceHeight - 1);
+		const int y1 = std::min(y * 2 + 1, sourceHeight - 1);
+		decodeRow(source + (size_t)y0 * sourceCount, sourceWidth, channels, top.data());
+		decodeRow(source + (size_t)y1 * sourceCount, sourceWidth, channels, bottom.data());
+
+		// Vertical pairs
+		int i = 0;
+#if MIP_LANES == 8
+		for (; i + 8 <= sourceCount; i += 8)
+			_mm256_storeu_ps(&sum[i], _mm256_add_ps(_mm256_loadu_ps(&top[i]), _mm256_loadu_ps(&bottom[i])));
+#elif MIP_LANES == 4
+		for (; i + 4 <= sourceCount; i += 4)
+			_mm_storeu_ps(&sum[i], _mm_add_ps(_mm_loadu_ps(&top[i]), _mm_loadu_ps(&bottom[i])));
+#endif
+		for (; i < sourceCount; ++i)
+			sum[i] = top[i] + bottom[i];
+
+		// Horizontal pairs; pixels whose right neighbour exists take the vector paths
+		int x = 0;
+#if MIP_LANES >= 4
+		const int paired = std::min(width, sourceWidth / 2);
+#endif
+#if MIP_LANES == 8
+		if (channels == 4)
+		{
+			// Two target pixels per register: source pixels 2x and 2x+2 against 2x+1 and 2x+3
+			const __m256 quarter = _mm256_set1_ps(0.25f);
+			for (; x + 2 <= paired; x += 2)
+			{
+				__m256 a = _mm256_loadu_ps(&sum[x * 8]);
+				__m256 b = _mm256_loadu_ps(&sum[x * 8 + 8]);
+				__m256 even = _mm256_permute2f128_ps(a, b, 0x20);
+				__m256 odd = _mm256_permute2f128_ps(a, b, 0x31);
+				_mm256_storeu_ps(&result[x * 4], _mm256_mul_ps(_mm256_add_ps(even, odd), quarter));
+			}
+		}
+#endif
+#if MIP_LANES >= 4
+		if (channels == 3 || channels == 4)
+		{
+			// One target pixel per register; with 3 channels the fourth lane is overwritten by the next pixel
+			const __m128 quarter = _mm_set1_ps(0.25f);
+			for (; x < paired; ++x)
+			{
+				__m128 left = _mm_loadu_ps(&sum[x * 2 * channels]);
+				__m128 right = _mm_loadu_ps(&sum[(x * 2 + 1) * channels]);
+				_mm_storeu_ps(&result[x * channels], _mm_mul_ps(_mm_add_ps(left, right), quarter));
+			}
+		}
+#endif
+		for (; x < width; ++x)
+		{
+			const int x0 = std::min(x * 2, sourceWidth - 1);
+			const int x1 = std::min(x * 2 + 1, sourceWidth - 1);
+			for (int c = 0; c < channels; ++c)
+				result[x * channels + c] = (sum[x0 * channels + c] + sum[x1 * channels + c]) * 0.25f;
+		}
+
+		encodeRow(result.data(), width, channels, target + (size_t)y * count);
+	}
+}
+
+void MipGenerator::generate(const std::vector<unsigned char*>& pixels, const std::vector<MipLevel>& levels, int channels, int threadCount)
+{
+	srgbTables(); // built once, before any thread needs them
+
+	for (size_t level = 1; level < levels.size(); ++level)
+	{
+		const MipLevel& source = levels[level - 1];
+		const MipLevel& target = levels[level];
+		const int count = std::max(1, std::min(threadCount, target.height / 16)); // threads only pay off on tall levels
+
+		std::vector<std::thread> threads;
+		for (int t = 1; t < count; ++t)
+		{
+			int first = target.height * t / count;
+			int end = target.height * (t + 1) / count;
+			threads.push_back(std::thread(&MipGenerator::downsampleRows, pixels[level - 1], source.width, source.height, pixels[level], target.width, channels, first, end));
+		}
+		downsampleRows(pixels[level - 1], source.width, source.height, pixels[level], target.width, channels, 0, target.height / count);
+		for (size_t i = 0; i < threads.size(); ++i)
+			threads[i].join();
+	}
+}
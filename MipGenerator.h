@@ -0,0 +1,28 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+
+// Size of one level of a mip chain
+struct MipLevel
+{
+	int width;
+	int height;
+	size_t size;     // bytes, rows tightly packed
+};
+
+// Builds mip chains of 8-bit images on the CPU, in place of glGenerateMipmap. Each level halves
+// the one above with a 2x2 box filter applied in linear light: colour channels are decoded from
+// sRGB through a table, averaged and re-encoded, alpha is averaged as stored. The filter adds
+// 8 floats per AVX instruction (4 per SSE), with identical results on every path, and each
+// level's rows are split across threads.
+class MipGenerator
+{
+	static void downsampleRows(const unsigned char* source, int sourceWidth, int sourceHeight, unsigned char* target, int width, int channels, int firstRow, int endRow);
+
+public:
+	// Sizes of every level down to 1x1, level 0 first
+	static void layout(int width, int height, int channels, std::vector<MipLevel>& levels);
+
+	// Fills levels 1 and up from level 0. pixels[i] points at level i, sized as layout() says.
+	static void generate(const std::vector<unsigned char*>& pixels, const std::vector<MipLevel>& levels, int channels, int threadCount);
+};
@@ -0,0 +1,79 @@
+#include "NormalMatrix.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define NORMAL_MATRIX_SSE
+#endif
+
+// With model columns a, b and c, the inverse transpose is [b x c, c x a, a x b] / det,
+// where det = a . (b x c). This avoids a general inverse and a transpose.
+glm::mat3 NormalMatrix::fromModel(const glm::mat4& model)
+{
+	glm::vec3 a(model[0]);
+	glm::vec3 b(model[1]);
+	glm::vec3 c(model[2]);
+
+	glm::vec3 bc = glm::cross(b, c);
+	float det = glm::dot(a, bc);
+	float invDet = det != 0.0f ? 1.0f / det : 1.0f;
+
+	glm::mat3 ret;
+	ret[0] = bc * invDet;
+	ret[1] = glm::cross(c, a) * invDet;
+	ret[2] = glm::cross(a, b) * invDet;
+	return ret;
+}
+
+#ifdef NORMAL_MATRIX_SSE
+// Cross product of the xyz lanes; the w lane of the result is 0
+static inline __m128 cross(__m128 a, __m128 b)
+{
+	__m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 c = _mm_sub_ps(_mm_mul_ps(a, bYZX), _mm_mul_ps(aYZX, b));
+	return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+#endif
+
+void NormalMatrix::computeBatch(const glm::mat4* models, size_t modelStride, glm::mat3* normals, size_t normalStride, size_t count)
+{
+	const char* modelBytes = reinterpret_cast<const char*>(models);
+	char* normalBytes = reinterpret_cast<char*>(normals);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		const glm::mat4& model = *reinterpret_cast<const glm::mat4*>(modelBytes + i * modelStride);
+		float* out = reinterpret_cast<float*>(normalBytes + i * normalStride);
+
+#ifdef NORMAL_MATRIX_SSE
+		// One model column per register, the w lane is ignored
+		__m128 a = _mm_loadu_ps(&model[0].x);
+		__m128 b = _mm_loadu_ps(&model[1].x);
+		__m128 c = _mm_loadu_ps(&model[2].x);
+
+		__m128 bc = cross(b, c);
+		__m128 ca = cross(c, a);
+		__m128 ab = cross(a, b);
+
+		// det = a . (b x c), summed across the lanes (w of bc is 0)
+		__m128 products = _mm_mul_ps(a, bc);
+		__m128 sum = _mm_add_ps(products, _mm_movehl_ps(products, products));
+		sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)));
+		float det = _mm_cvtss_f32(sum);
+		__m128 invDet = _mm_set1_ps(det != 0.0f ? 1.0f / det : 1.0f);
+
+		// mat3 columns are packed 3 floats apart: the first two 4-wide stores spill one float
+		// into the next column, which the following store overwrites; the last column is stored as 2 + 1 floats
+		_mm_storeu_ps(out, _mm_mul_ps(bc, invDet));
+		_mm_storeu_ps(out + 3, _mm_mul_ps(ca, invDet));
+		__m128 last = _mm_mul_ps(ab, invDet);
+		_mm_storel_pi(reinterpret_cast<__m64*>(out + 6), last);
+		_mm_store_ss(out + 8, _mm_movehl_ps(last, last));
+#else
+		glm::mat3 normal = fromModel(model);
+		for (int column = 0; column < 3; ++column)
+			for (int row = 0; row < 3; ++row)
+				out[column * 3 + row] = normal[column][row];
+#endif
+	}
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstddef>
+
+// Normal matrices (inverse transpose of a model matrix's upper 3x3), built on the CPU so
+// vertex shaders read them instead of inverting the model matrix for every vertex
+class NormalMatrix
+{
+public:
+	static glm::mat3 fromModel(const glm::mat4& model);
+
+	// Writes the normal matrices of count models. Models and results are read and written
+	// stride bytes apart, so both can live inside an array of per-instance structs.
+	static void computeBatch(const glm::mat4* models, size_t modelStride, glm::mat3* normals, size_t normalStride, size_t count);
+};
@@ -0,0 +1,123 @@
+#include "RenderQueue.h"
+#include <utility>
+
+#define NUM_KEY_BYTES 8
+
+uint64_t RenderQueue::makeKey(const DrawItem& item)
+{
+	const uint64_t ID_MASK = 0xFFF;
+	const uint64_t DEPTH_MAX = 0xFFFFFF;
+
+	float depth = item.depth < 0.0f ? 0.0f : (item.depth > 1.0f ? 1.0f : item.depth);
+	uint64_t depthBits = (uint64_t)(depth * DEPTH_MAX);
+	if (item.pass == PASS_TRANSPARENT)
+		depthBits = DEPTH_MAX - depthBits;
+
+	// Names wider than their field only lose sorting quality; state is still compared on the real names
+	return ((uint64_t)item.pass << 60)
+		| ((item.program & ID_MASK) << 48)
+		| ((item.texture & ID_MASK) << 36)
+		| ((item.vao & ID_MASK) << 24)
+		| depthBits;
+}
+
+void RenderQueue::clear()
+{
+	items.clear();
+	entries.clear();
+}
+
+void RenderQueue::push(const DrawItem& item)
+{
+	SortEntry entry;
+	entry.key = makeKey(item);
+	entry.index = (uint32_t)items.size();
+	entries.push_back(entry);
+	items.push_back(item);
+}
+
+// LSD radix sort over the key bytes, skipping bytes that every key shares
+void RenderQueue::sort()
+{
+	const size_t count = entries.size();
+	if (count < 2)
+		return;
+	scratch.resize(count);
+
+	// Gather every byte's histogram in one pass over the keys
+	uint32_t histograms[NUM_KEY_BYTES][256] = {};
+	for (size_t i = 0; i < count; ++i)
+	{
+		uint64_t key = entries[i].key;
+		for (int b = 0; b < NUM_KEY_BYTES; ++b)
+			++histograms[b][(key >> (b * 8)) & 0xFF];
+	}
+
+	SortEntry* src = entries.data();
+	SortEntry* dst = scratch.data();
+	for (int b = 0; b < NUM_KEY_BYTES; ++b)
+	{
+		const int shift = b * 8;
+		uint32_t* histogram = histograms[b];
+		if (histogram[(src[0].key >> shift) & 0xFF] == count)
+			continue;
+
+		uint32_t offset = 0;
+		for (int d = 0; d < 256; ++d)
+		{
+			uint32_t digitCount = histogram[d];
+			histogram[d] = offset;
+			offset += digitCount;
+		}
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			const SortEntry& entry = src[i];
+			dst[histogram[(entry.key >> shift) & 0xFF]++] = entry;
+		}
+		std::swap(src, dst);
+	}
+
+	if (src != entries.data())
+		entries.swap(scratch);
+}
+
+void RenderQueue::submit(GLStateCache& state, GPUProfiler* profiler)
+{
+	stats = RenderQueueStats();
+
+	GLuint currentProgram = 0;
+	const void* currentMaterial = 0;
+
+	state.activeTexture(GL_TEXTURE0);
+
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		const DrawItem& item = items[entries[i].index];
+		const bool timed = profiler && item.name;
+		if (timed)
+			profiler->begin(item.name);
+
+		state.useProgram(item.program);
+		if (item.program != currentProgram)
+		{
+			currentProgram = item.program;
+			currentMaterial = 0; // material uniforms live in the program
+		}
+		state.bindVertexArray(item.vao);
+		if (item.texture != 0)
+			state.bindTexture(GL_TEXTURE_2D, item.texture);
+		if (item.material != currentMaterial && item.bindMaterial)
+		{
+			item.bindMaterial(item.material);
+			currentMaterial = item.material;
+			++stats.materialChanges;
+		}
+
+		glMultiDrawElementsIndirect(item.mode, item.indexType, (void*)item.indirectOffset, item.drawCount, 0);
+		++stats.drawCalls;
+
+		if (timed)
+			profiler->end();
+	}
+}
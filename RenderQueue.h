@@ -0,0 +1,71 @@
+#pragma once
+#include <GL/glew.h>
+#include "GLStateCache.h"
+#include "GPUProfiler.h"
+#include <vector>
+#include <cstdint>
+
+// Render passes, submitted in this order
+enum RenderPass
+{
+	PASS_OPAQUE,         // sorted front-to-back
+	PASS_TRANSPARENT     // sorted back-to-front
+};
+
+// Everything needed to issue one glMultiDrawElementsIndirect call, which reads drawCount commands
+// from the bound GL_DRAW_INDIRECT_BUFFER at indirectOffset; the per-instance attributes hold the models
+struct DrawItem
+{
+	RenderPass pass;
+	GLuint program;
+	GLuint vao;
+	GLuint texture;                  // Bound on texture unit 0, 0 when the program samples nothing
+	float depth;                     // View distance normalized to [0, 1]
+
+	// Per-material uniforms, only re-sent when the material (or program) changes. May be null.
+	const void* material;
+	void (*bindMaterial)(const void* material);
+
+	GLenum mode;
+	GLenum indexType;
+	GLsizei drawCount;
+	GLintptr indirectOffset;
+
+	const char* name;                // GPU profiler section of the draw, may be null
+};
+
+// Work done by the last submit() (bind calls are counted by the GLStateCache)
+struct RenderQueueStats
+{
+	uint32_t drawCalls;
+	uint32_t materialChanges;
+};
+
+// Collects the draws of a frame, sorts them by a 64-bit state key and submits them
+// in that order through a GLStateCache, so consecutive draws sharing state skip the redundant GL calls
+class RenderQueue
+{
+	struct SortEntry
+	{
+		uint64_t key;
+		uint32_t index;
+	};
+
+	std::vector<DrawItem> items;
+	std::vector<SortEntry> entries;
+	std::vector<SortEntry> scratch;
+	RenderQueueStats stats;
+
+public:
+	// Key layout, most significant first: pass (4 bits), program (12), texture (12), VAO (12), depth (24)
+	static uint64_t makeKey(const DrawItem& item);
+
+	void clear();
+	void push(const DrawItem& item);
+	void sort();
+	// Draws with a name are timed as GPU profiler sections when a profiler is given
+	void submit(GLStateCache& state, GPUProfiler* profiler = 0);
+
+	size_t size() const { return items.size(); }
+	const RenderQueueStats& getStats() const { return stats; }
+};
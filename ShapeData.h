@@ -0,0 +1,34 @@
+#pragma once
+#include <GL/glew.h>
+#include "Vertex.h"
+#include "BoundingVolume.h"
+
+// CPU-side geometry produced by ShapeGenerator (arrays are allocated with new[])
+struct ShapeData
+{
+	ShapeData() : vertices(0), numVertices(0), indices(0), numIndices(0) {}
+	Vertex* vertices;
+	GLuint numVertices;
+	GLushort* indices;
+	GLuint numIndices;
+	BoundingVolume bounds;           // Filled in by ShapeGenerator once the vertices are final
+
+	GLsizeiptr vertexBufferSize() const
+	{
+		return numVertices * sizeof(Vertex);
+	}
+	GLsizeiptr indexBufferSize() const
+	{
+		return numIndices * sizeof(GLushort);
+	}
+
+	// Releases the vertex and index arrays once they have been uploaded to the GPU
+	void cleanup()
+	{
+		delete[] vertices;
+		delete[] indices;
+		vertices = 0;
+		indices = 0;
+		numVertices = numIndices = 0;
+	}
+};
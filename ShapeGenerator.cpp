@@ -2,6 +2,8 @@
 #include <glm\glm.hpp>
 #include <glm\gtc\matrix_transform.hpp>
 #include "Vertex.h"
+#include <cassert>
+#include "CPUProfiler.h"
 
 #define PI 3.14159265359
 using glm::vec3;
@@ -59,22 +61,25 @@ ShapeData ShapeGenerator::makePlaneIndices(uint dimensions)
 			ret.indices[runner++] = dimensions * row + col + 1;
 		}
 	}
-	assert(runner = ret.numIndices);
+	assert(runner == ret.numIndices);
 	return ret;
 }
 
 
 ShapeData ShapeGenerator::makePlane(uint dimensions)
 {
+	CPU_PROFILE_SCOPE("ShapeGenerator::makePlane");
 	ShapeData ret = makePlaneVerts(dimensions);
 	ShapeData ret2 = makePlaneIndices(dimensions);
 	ret.numIndices = ret2.numIndices;
 	ret.indices = ret2.indices;
+	ret.bounds = BoundingVolume::fromPositions(&ret.vertices[0].position, ret.numVertices, sizeof(Vertex));
 	return ret;
 }
 
 ShapeData ShapeGenerator::makeSphere(uint tesselation)
 {
+	CPU_PROFILE_SCOPE("ShapeGenerator::makeSphere");
 	ShapeData ret = makePlaneVerts(tesselation);
 	ShapeData ret2 = makePlaneIndices(tesselation);
 	ret.indices = ret2.indices;
@@ -98,5 +103,6 @@ ShapeData ShapeGenerator::makeSphere(uint tesselation)
 			v.normal = glm::normalize(v.position);
 		}
 	}
+	ret.bounds = BoundingVolume::fromPositions(&ret.vertices[0].position, ret.numVertices, sizeof(Vertex));
 	return ret;
 }
\ No newline at end of file
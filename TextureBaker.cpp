@@ -0,0 +1,118 @@
+// Offline texture baker: reads JPEG/PNG/TGA/BMP sources with stb_image, builds a gamma-correct
+// mip chain (MipGenerator), block-compresses every level and writes a KTX2 file next to each source
+// (ContainerTexture.jpg -> ContainerTexture.ktx2). The renderer loads a baked file in place of
+// its source when one exists, skipping decode and mip generation at startup.
+//
+//   TextureBaker [--bc1 | --bc3] [--threads N] image...
+//
+// Without a format option each image gets BC1 when it is fully opaque and BC3 otherwise.
+// BC7 is not implemented: --bc7 is refused rather than quietly baking something else.
+// Build as its own executable from TextureBaker.cpp, BCnEncoder.cpp, MipGenerator.cpp and Ktx2File.cpp, for example:
+//   g++ -O2 -std=c++11 -msse2 TextureBaker.cpp BCnEncoder.cpp MipGenerator.cpp Ktx2File.cpp -lpthread -o TextureBaker
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include "BCnEncoder.h"
+#include "MipGenerator.h"
+#include "Ktx2File.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+static bool bake(const char* source, int forcedFormat, int threadCount)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	int width, height, channels;
+	unsigned char* pixels = stbi_load(source, &width, &height, &channels, 4);
+	if (!pixels)
+	{
+		printf("%s: %s\n", source, stbi_failure_reason());
+		return false;
+	}
+
+	BCnFormat format = BCN_BC1;
+	if (forcedFormat >= 0)
+		format = (BCnFormat)forcedFormat;
+	else
+		for (size_t i = 3; i < (size_t)width * height * 4; i += 4)
+			if (pixels[i] != 255)
+			{
+				format = BCN_BC3;
+				break;
+			}
+
+	std::vector<MipLevel> levels;
+	MipGenerator::layout(width, height, 4, levels);
+	std::vector<std::vector<unsigned char> > chain(levels.size());
+	std::vector<unsigned char*> levelPixels(1, pixels);
+	for (size_t i = 1; i < levels.size(); ++i)
+	{
+		chain[i].resize(levels[i].size);
+		levelPixels.push_back(chain[i].data());
+	}
+	MipGenerator::generate(levelPixels, levels, 4, threadCount);
+
+	std::vector<std::vector<unsigned char> > encoded(levels.size());
+	for (size_t i = 0; i < levels.size(); ++i)
+	{
+		encoded[i].resize(BCnEncoder::encodedSize(format, levels[i].width, levels[i].height));
+		BCnEncoder::encode(format, levelPixels[i], levels[i].width, levels[i].height, encoded[i].data(), threadCount);
+	}
+	stbi_image_free(pixels);
+
+	std::string target = Ktx2File::bakedPath(source);
+	uint32_t vkFormat = format == BCN_BC1 ? KTX2_FORMAT_BC1_RGB_SRGB : KTX2_FORMAT_BC3_SRGB;
+	if (!Ktx2File::write(target.c_str(), vkFormat, width, height, encoded))
+	{
+		printf("%s: could not write %s\n", source, target.c_str());
+		return false;
+	}
+
+	size_t bytes = 0;
+	for (size_t i = 0; i < encoded.size(); ++i)
+		bytes += encoded[i].size();
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	printf("%s -> %s: %dx%d %s, %d levels, %zu KB (%.1f ms)\n", source, target.c_str(), width, height,
+		format == BCN_BC1 ? "BC1" : "BC3", (int)encoded.size(), bytes / 1024, ms);
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	int forcedFormat = -1;
+	int threadCount = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<const char*> sources;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--bc1") == 0)
+			forcedFormat = BCN_BC1;
+		else if (strcmp(argv[i], "--bc3") == 0)
+			forcedFormat = BCN_BC3;
+		else if (strcmp(argv[i], "--bc7") == 0)
+		{
+			printf("--bc7: BC7 is not implemented, use --bc3 for images with alpha\n");
+			return EXIT_FAILURE;
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			threadCount = std::max(1, atoi(argv[++i]));
+		else
+			sources.push_back(argv[i]);
+	}
+	if (sources.empty())
+	{
+		printf("usage: %s [--bc1 | --bc3] [--threads N] image...\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	bool ok = true;
+	for (size_t i = 0; i < sources.size(); ++i)
+		ok = bake(sources[i], forcedFormat, threadCount) && ok;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
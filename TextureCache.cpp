@@ -0,0 +1,177 @@
+#include "TextureCache.h"
+#include "CPUProfiler.h"
+#include "AssetPack.h"
+#include "FileUtils.h"
+#include <cctype>
+#include <cstdlib>
+#include <iostream>
+
+TextureCache::TextureCache(TextureLoader& loader)
+	: loader(loader), hits(0)
+{
+}
+
+// Absolute path with links and dot segments resolved; the path as given when it does not exist
+std::string TextureCache::canonicalPath(const char* path)
+{
+	std::string canonical = path;
+#ifdef _WIN32
+	char resolved[_MAX_PATH];
+	if (_fullpath(resolved, path, _MAX_PATH))
+		canonical = resolved;
+	// Windows paths are case-insensitive and take either separator
+	for (size_t i = 0; i < canonical.size(); ++i)
+		canonical[i] = canonical[i] == '\\' ? '/' : (char)tolower((unsigned char)canonical[i]);
+#else
+	char* resolved = realpath(path, NULL);
+	if (resolved)
+	{
+		canonical = resolved;
+		free(resolved);
+	}
+#endif
+	return canonical;
+}
+
+// The hash asset packs store, so a packed image and a loose copy of it share one texture
+uint64_t TextureCache::hashContents(const unsigned char* data, size_t size)
+{
+	return AssetPack::hash(data, size);
+}
+
+// A texture of the same size and contents; same-size textures not hashed yet are hashed now
+GLuint TextureCache::findContents(size_t size, uint64_t hash)
+{
+	std::pair<std::multimap<size_t, GLuint>::iterator, std::multimap<size_t, GLuint>::iterator> same = bySize.equal_range(size);
+	for (std::multimap<size_t, GLuint>::iterator it = same.first; it != same.second; ++it)
+	{
+		Entry& entry = entries[it->second];
+		if (!entry.hashed)
+		{
+			// Only loose files go unhashed, and their paths are real
+			std::vector<unsigned char> contents;
+			if (!FileUtils::readAll(entry.paths[0].c_str(), contents))
+				continue;
+			entry.hash = hashContents(contents.data(), contents.size());
+			entry.hashed = true;
+		}
+		if (entry.hash == hash)
+			return it->second;
+	}
+	return 0;
+}
+
+GLuint TextureCache::share(GLuint texture, const std::string& path)
+{
+	Entry& entry = entries[texture];
+	entry.paths.push_back(path);
+	++entry.references;
+	byPath[path] = texture;
+	++hits;
+	return texture;
+}
+
+void TextureCache::add(GLuint texture, const std::string& path, size_t size, uint64_t hash, bool hashed)
+{
+	Entry& entry = entries[texture];
+	entry.size = size;
+	entry.hash = hash;
+	entry.hashed = hashed;
+	entry.references = 1;
+	entry.paths.push_back(path);
+	byPath[path] = texture;
+	bySize.insert(std::make_pair(size, texture));
+}
+
+GLuint TextureCache::acquire(const char* path, GLStateCache& state)
+{
+	CPU_PROFILE_FUNCTION();
+	std::string canonical = canonicalPath(path);
+
+	std::map<std::string, GLuint>::iterator known = byPath.find(canonical);
+	if (known != byPath.end())
+	{
+		++entries[known->second].references;
+		++hits;
+		return known->second;
+	}
+
+	size_t size;
+	if (!FileUtils::size(path, size))
+		return 0;
+
+	// No image of this size is held, so none can be a copy: the worker reads the file
+	if (bySize.find(size) == bySize.end())
+	{
+		GLuint texture = loader.request(path, state);
+		add(texture, canonical, size, 0, false);
+		return texture;
+	}
+
+	// Read the file here to compare it; the loader decodes these same bytes
+	std::vector<unsigned char> contents;
+	if (!FileUtils::readAll(path, contents))
+		return 0;
+
+	uint64_t hash = hashContents(contents.data(), contents.size());
+	GLuint same = findContents(contents.size(), hash);
+	if (same)
+		return share(same, canonical);
+
+	GLuint texture = loader.request(path, contents, state);
+	add(texture, canonical, contents.size(), hash, true);
+	return texture;
+}
+
+GLuint TextureCache::acquireMapped(const char* name, const unsigned char* data, size_t size, uint64_t hash, GLStateCache& state)
+{
+	std::string key = std::string("pack:") + name;
+
+	std::map<std::string, GLuint>::iterator known = byPath.find(key);
+	if (known != byPath.end())
+	{
+		++entries[known->second].references;
+		++hits;
+		return known->second;
+	}
+
+	GLuint same = findContents(size, hash);
+	if (same)
+		return share(same, key);
+
+	GLuint texture = loader.request(name, data, size, state);
+	add(texture, key, size, hash, true);
+	return texture;
+}
+
+void TextureCache::release(GLuint texture, GLStateCache& state)
+{
+	std::map<GLuint, Entry>::iterator found = entries.find(texture);
+	if (found == entries.end())
+	{
+		if (texture != 0)
+			std::cout << "Released texture " << texture << " that the cache does not hold" << std::endl;
+		return;
+	}
+
+	Entry& entry = found->second;
+	if (--entry.references > 0)
+		return;
+
+	for (size_t i = 0; i < entry.paths.size(); ++i)
+		byPath.erase(entry.paths[i]);
+	std::pair<std::multimap<size_t, GLuint>::iterator, std::multimap<size_t, GLuint>::iterator> same = bySize.equal_range(entry.size);
+	for (std::multimap<size_t, GLuint>::iterator it = same.first; it != same.second; ++it)
+	{
+		if (it->second == texture)
+		{
+			bySize.erase(it);
+			break;
+		}
+	}
+	entries.erase(found);
+
+	loader.cancel(texture);
+	state.forgetTexture(texture);
+	glDeleteTextures(1, &texture);
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <GL/glew.h>
+#include "GLStateCache.h"
+#include "TextureLoader.h"
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Shares one texture between every user of the same image. Textures are found by canonical
+// path, so different spellings of a file resolve to one entry, and by a hash of the file
+// contents, so copies of an image under different names do too. Contents are only read and
+// hashed on the GL thread when their size matches a texture already held; any other file
+// goes to the loader unread. acquire() and release() count references and the last release
+// deletes the texture.
+class TextureCache
+{
+	struct Entry
+	{
+		size_t size;                       // bytes of the file or packed blob
+		uint64_t hash;
+		bool hashed;                       // false until another image of the same size turns up
+		uint32_t references;
+		std::vector<std::string> paths;    // canonical paths resolving to this texture
+	};
+
+	TextureLoader& loader;
+	std::map<GLuint, Entry> entries;
+	std::map<std::string, GLuint> byPath;
+	std::multimap<size_t, GLuint> bySize;
+	uint32_t hits;                     // acquires served by an existing texture
+
+	GLuint findContents(size_t size, uint64_t hash);
+	GLuint share(GLuint texture, const std::string& path);
+	void add(GLuint texture, const std::string& path, size_t size, uint64_t hash, bool hashed);
+
+public:
+	explicit TextureCache(TextureLoader& loader);
+
+	static std::string canonicalPath(const char* path);
+	static uint64_t hashContents(const unsigned char* data, size_t size);
+
+	// Returns a texture holding the image, queueing a load on a miss; 0 when the file cannot be read
+	GLuint acquire(const char* path, GLStateCache& state);
+
+	// Same for KTX2 contents mapped for the rest of the run, such as an asset pack's texture blob:
+	// name stands in for the path (no file system lookup) and hash is the pack's hash of the contents
+	GLuint acquireMapped(const char* name, const unsigned char* data, size_t size, uint64_t hash, GLStateCache& state);
+
+	// Drops one reference taken by acquire(); 0 is ignored
+	void release(GLuint texture, GLStateCache& state);
+
+	size_t size() const { return entries.size(); }
+	uint32_t getHits() const { return hits; }
+};
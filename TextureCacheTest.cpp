@@ -0,0 +1,170 @@
+// Checks that TextureCache and TextureLoader keep a released texture's pending image away from the
+// next texture GL gives the same name:
+//   after upload   - acquire, upload, release, then acquire another image
+//   while decoding - acquire, release straight away, then acquire another image
+// Each second image must land in its texture at its own size, and nothing may stay pending.
+// It also checks that a copy of an image under another name shares its texture, and that an image
+// of the same size with other contents does not.
+// The images are written as small binary PPM files next to the executable and removed afterwards.
+//
+// Needs a GL 4.4 context, which it creates in an invisible window. Build and run on its own, for example:
+//   g++ -std=c++11 TextureCacheTest.cpp TextureCache.cpp TextureLoader.cpp GLStateCache.cpp AssetPack.cpp
+//       FileUtils.cpp DecodeArena.cpp MipGenerator.cpp Ktx2File.cpp CPUProfiler.cpp
+//       -lglfw -lGLEW -lGL -lpthread -o TextureCacheTest && ./TextureCacheTest
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "DecodeArena.h"
+#define STBI_MALLOC(size) DecodeArena::allocate(size)
+#define STBI_REALLOC_SIZED(p, oldSize, newSize) DecodeArena::reallocate(p, oldSize, newSize)
+#define STBI_FREE(p) DecodeArena::release(p)
+#include "stb_image.h"
+
+#include "GLStateCache.h"
+#include "TextureCache.h"
+#include "TextureLoader.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static const char* FIRST = "TextureCacheTest-first.ppm";
+static const char* SECOND = "TextureCacheTest-second.ppm";
+static const char* COPY = "TextureCacheTest-copy.ppm";
+static const char* OTHER = "TextureCacheTest-other.ppm";
+static const int FIRST_SIZE = 256;
+static const int SECOND_SIZE = 32;
+static const int ROUNDS = 16;
+
+static bool writeImage(const char* path, int size, unsigned char seed)
+{
+	FILE* f = fopen(path, "wb");
+	if (!f)
+		return false;
+	fprintf(f, "P6\n%d %d\n255\n", size, size);
+	std::vector<unsigned char> pixels((size_t)size * size * 3);
+	for (size_t i = 0; i < pixels.size(); ++i)
+		pixels[i] = (unsigned char)(i * 7 + seed);
+	bool written = fwrite(pixels.data(), 1, pixels.size(), f) == pixels.size();
+	return fclose(f) == 0 && written;
+}
+
+static int textureWidth(GLuint texture, GLStateCache& state)
+{
+	GLint width = 0;
+	state.activeTexture(GL_TEXTURE0);
+	state.bindTexture(GL_TEXTURE_2D, texture);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+	return width;
+}
+
+// Acquires SECOND after the first texture was released, then checks it received its image
+static bool checkSecond(const char* scenario, GLuint first, TextureCache& cache, TextureLoader& loader, GLStateCache& state)
+{
+	GLuint second = cache.acquire(SECOND, state);
+	loader.finish(state);
+
+	int width = textureWidth(second, state);
+	bool passed = width == SECOND_SIZE && loader.pending() == 0 && loader.failed() == 0;
+	if (!passed)
+		printf("%s: texture %u (%s name %u) is %d wide, expected %d; %zu pending, %zu failed\n", scenario, second,
+			second == first ? "reusing" : "after", first, width, SECOND_SIZE, loader.pending(), loader.failed());
+	cache.release(second, state);
+	return passed;
+}
+
+static bool afterUpload(TextureCache& cache, TextureLoader& loader, GLStateCache& state)
+{
+	bool passed = true;
+	for (int round = 0; round < ROUNDS; ++round)
+	{
+		GLuint first = cache.acquire(FIRST, state);
+		loader.finish(state);
+		cache.release(first, state);
+		passed = checkSecond("after upload", first, cache, loader, state) && passed;
+	}
+	return passed;
+}
+
+static bool whileDecoding(TextureCache& cache, TextureLoader& loader, GLStateCache& state)
+{
+	bool passed = true;
+	for (int round = 0; round < ROUNDS; ++round)
+	{
+		GLuint first = cache.acquire(FIRST, state);
+		cache.release(first, state);
+		passed = checkSecond("while decoding", first, cache, loader, state) && passed;
+	}
+	return passed;
+}
+
+static bool copies(TextureCache& cache, TextureLoader& loader, GLStateCache& state)
+{
+	GLuint first = cache.acquire(FIRST, state);
+	GLuint copy = cache.acquire(COPY, state);
+	GLuint other = cache.acquire(OTHER, state);
+	loader.finish(state);
+
+	bool passed = copy == first && other != first && textureWidth(other, state) == FIRST_SIZE;
+	if (!passed)
+		printf("copies: %s is texture %u and %s %u, expected %u; %s is texture %u\n", FIRST, first, COPY, copy, first, OTHER, other);
+	cache.release(other, state);
+	cache.release(copy, state);
+	cache.release(first, state);
+	return passed && cache.size() == 0;
+}
+
+static void removeImages()
+{
+	remove(FIRST);
+	remove(SECOND);
+	remove(COPY);
+	remove(OTHER);
+}
+
+int main()
+{
+	if (!writeImage(FIRST, FIRST_SIZE, 0) || !writeImage(SECOND, SECOND_SIZE, 0) ||
+		!writeImage(COPY, FIRST_SIZE, 0) || !writeImage(OTHER, FIRST_SIZE, 1))
+	{
+		printf("Can't write the test images\n");
+		removeImages();
+		return EXIT_FAILURE;
+	}
+
+	glfwInit();
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	GLFWwindow* window = glfwCreateWindow(64, 64, "TextureCacheTest", NULL, NULL);
+	if (!window)
+	{
+		printf("Can't create a GL 4.4 context\n");
+		removeImages();
+		glfwTerminate();
+		return EXIT_FAILURE;
+	}
+	glfwMakeContextCurrent(window);
+	glewExperimental = GL_TRUE;
+	glewInit();
+
+	bool passed;
+	{
+		GLStateCache state;
+		TextureLoader loader;
+		TextureCache cache(loader);
+		passed = afterUpload(cache, loader, state);
+		passed = whileDecoding(cache, loader, state) && passed;
+		passed = copies(cache, loader, state) && passed;
+		loader.shutdown();
+	}
+
+	glfwDestroyWindow(window);
+	glfwTerminate();
+	removeImages();
+
+	printf("%s\n", passed ? "passed" : "FAILED");
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,561 @@
+#include "TextureLoader.h"
+#include "CPUProfiler.h"
+#include "DecodeArena.h"
+#include "FileUtils.h"
+#include "stb_image.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <utility>
+#include <iostream>
+
+// GL internal format of each KTX2 format TextureBaker and asset packs write. The _SRGB formats are
+// sampled as UNORM like every other texture: lighting works on the encoded values.
+static GLenum internalFormat(uint32_t vkFormat)
+{
+	switch (Ktx2File::unormFormat(vkFormat))
+	{
+	case KTX2_FORMAT_R8G8B8_UNORM: return GL_RGB8;
+	case KTX2_FORMAT_R8G8B8A8_UNORM: return GL_RGBA8;
+	case KTX2_FORMAT_BC1_RGB_UNORM: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case KTX2_FORMAT_BC3_UNORM: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	default: return 0;
+	}
+}
+
+TextureLoader::TextureLoader()
+	: mipThreads(1), stopping(false), nextRequest(0), nextSlot(0), outstanding(0), failures(0)
+{
+	for (int i = 0; i < STAGING_SLOTS; ++i)
+	{
+		slots[i].buffer = 0;
+		slots[i].mapped = 0;
+		slots[i].capacity = 0;
+		slots[i].fence = 0;
+	}
+}
+
+TextureLoader::~TextureLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+}
+
+// One worker per spare core, leaving the GL thread its own
+void TextureLoader::startWorkers()
+{
+	unsigned cores = std::thread::hardware_concurrency();
+	int count = std::max(1, std::min((int)MAX_WORKERS, (int)cores - 1));
+	mipThreads = std::max(1, (int)cores / count);
+	for (int i = 0; i < count; ++i)
+		workers.push_back(std::thread(&TextureLoader::workerMain, this));
+}
+
+void TextureLoader::workerMain()
+{
+	// Images stay top row first as decoded: the lit vertex shader flips v instead, which saves a pass over every image.
+	// The flag is per thread, so set it explicitly rather than inherit whatever the process default is.
+	stbi_set_flip_vertically_on_load_thread(0);
+
+	for (;;)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+			if (stopping)
+				return;
+			job.texture = jobs.front().texture;
+			job.request = jobs.front().request;
+			job.path.swap(jobs.front().path);
+			job.encoded.swap(jobs.front().encoded);
+			jobs.pop_front();
+		}
+
+		Image image;
+		image.texture = job.texture;
+		image.request = job.request;
+		image.path = job.path;
+
+		if (job.encoded.empty() && !FileUtils::readAll(job.path.c_str(), job.encoded))
+		{
+			image.pixels = 0;
+			image.failure = "can't fopen";
+		}
+		else if (Ktx2File::isKtx2(job.encoded.data(), job.encoded.size()))
+		{
+			parseKtx2(job.encoded.data(), job.encoded.size(), image);
+			image.file.swap(job.encoded); // the data keeps its address
+		}
+		else
+		{
+			decode(job.encoded, image);
+		}
+
+		bool idle;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			done.push_back(std::move(image));
+			idle = jobs.empty();
+		}
+		decoded.notify_one();
+
+		// Hand the arena's blocks back between bursts of loads
+		if (idle)
+			DecodeArena::trim();
+	}
+}
+
+// Decodes into a chain buffer sized for every mip level, then fills in the levels below the first
+void TextureLoader::decode(const std::vector<unsigned char>& encoded, Image& image)
+{
+	image.pixels = 0;
+	if (!stbi_info_from_memory(encoded.data(), (int)encoded.size(), &image.width, &image.height, &image.channels))
+	{
+		image.failure = stbi_failure_reason();
+		return;
+	}
+	if (image.channels != 3 && image.channels != 4)
+	{
+		image.failure = "only RGB and RGBA images are implemented";
+		return;
+	}
+
+	MipGenerator::layout(image.width, image.height, image.channels, image.levels);
+	size_t chainBytes = 0;
+	for (size_t i = 0; i < image.levels.size(); ++i)
+		chainBytes += image.levels[i].size;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!spareChains.empty())
+		{
+			image.chain.swap(spareChains.back());
+			spareChains.pop_back();
+		}
+	}
+	if (image.chain.size() < chainBytes)
+		image.chain.resize(chainBytes);
+
+	{
+		CPU_PROFILE_SCOPE("Decode texture");
+		DecodeArena::Scope arena;
+		const size_t stride = (size_t)image.width * image.channels;
+		if (!stbi_load_from_memory_into(encoded.data(), (int)encoded.size(), image.chain.data(), stride, image.levels[0].size,
+			&image.width, &image.height, &image.channels, image.channels))
+		{
+			image.failure = stbi_failure_reason();
+			image.levels.clear();
+			return;
+		}
+	}
+	image.pixels = image.chain.data();
+	image.failure = 0;
+
+	CPU_PROFILE_SCOPE("Generate mips");
+	std::vector<unsigned char*> levelPixels;
+	for (size_t i = 0, offset = 0; i < image.levels.size(); offset += image.levels[i].size, ++i)
+		levelPixels.push_back(image.chain.data() + offset);
+	MipGenerator::generate(levelPixels, image.levels, image.channels, mipThreads);
+}
+
+// Baked: the file already holds the GPU's format and every mip level
+void TextureLoader::parseKtx2(const unsigned char* data, size_t size, Image& image)
+{
+	if (Ktx2File::parse(data, size, image.ktx) && internalFormat(image.ktx.vkFormat))
+	{
+		image.pixels = const_cast<unsigned char*>(data);
+		image.width = (int)image.ktx.width;
+		image.height = (int)image.ktx.height;
+		image.channels = 0;
+		image.failure = 0;
+	}
+	else
+	{
+		image.ktx.levels.clear();
+		image.pixels = 0;
+		image.failure = "unsupported KTX2 file";
+	}
+}
+
+GLuint TextureLoader::request(const char* path, GLStateCache& state)
+{
+	Job job;
+	job.path = path;
+	return queue(job, state);
+}
+
+GLuint TextureLoader::request(const char* path, std::vector<unsigned char>& encoded, GLStateCache& state)
+{
+	Job job;
+	job.path = path;
+	job.encoded.swap(encoded);
+	return queue(job, state);
+}
+
+// Nothing to decode: the image goes straight to the ready queue
+GLuint TextureLoader::request(const char* path, const unsigned char* data, size_t size, GLStateCache& state)
+{
+	Image image;
+	image.texture = createPlaceholder(state);
+	image.request = track(image.texture);
+	image.path = path;
+	parseKtx2(data, size, image);
+	ready.push_back(std::move(image));
+	return ready.back().texture;
+}
+
+GLuint TextureLoader::queue(Job& job, GLStateCache& state)
+{
+	if (workers.empty())
+		startWorkers();
+
+	GLuint texture = createPlaceholder(state);
+	uint32_t request = track(texture);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(Job());
+		jobs.back().texture = texture;
+		jobs.back().request = request;
+		jobs.back().path.swap(job.path);
+		jobs.back().encoded.swap(job.encoded);
+	}
+	wake.notify_one();
+
+	return texture;
+}
+
+// Numbers a new request for the texture. GL may hand out the name of a deleted texture whose
+// cancelled image is still being decoded, so images are matched to requests, not names.
+uint32_t TextureLoader::track(GLuint texture)
+{
+	uint32_t request = nextRequest++;
+	inFlight[texture] = request;
+	++outstanding;
+	return request;
+}
+
+GLuint TextureLoader::createPlaceholder(GLStateCache& state)
+{
+	static const unsigned char PLACEHOLDER[4] = { 128, 128, 128, 255 };
+
+	GLuint texture;
+	glGenTextures(1, &texture);
+	state.activeTexture(GL_TEXTURE0);
+	state.bindTexture(GL_TEXTURE_2D, texture);
+
+	// set the texture wrapping parameters
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	// set texture filtering parameters
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, PLACEHOLDER);
+	return texture;
+}
+
+void TextureLoader::cancel(GLuint texture)
+{
+	// Uploaded, failed or never requested: nothing is pending for it
+	std::map<GLuint, uint32_t>::iterator found = inFlight.find(texture);
+	if (found == inFlight.end())
+		return;
+	uint32_t request = found->second;
+	inFlight.erase(found);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (std::deque<Job>::iterator it = jobs.begin(); it != jobs.end(); ++it)
+		{
+			if (it->request == request)
+			{
+				jobs.erase(it);
+				--outstanding;
+				return;
+			}
+		}
+	}
+
+	for (std::deque<Image>::iterator it = ready.begin(); it != ready.end(); ++it)
+	{
+		if (it->request == request)
+		{
+			freePixels(*it);
+			ready.erase(it);
+			--outstanding;
+			return;
+		}
+	}
+
+	// Being decoded, or decoded and not collected yet: dropped when update() sees it
+	cancelled.push_back(request);
+}
+
+size_t TextureLoader::imageBytes(const Image& image)
+{
+	size_t bytes = 0;
+	for (size_t i = 0; i < image.levels.size(); ++i)
+		bytes += image.levels[i].size;
+	for (size_t i = 0; i < image.ktx.levels.size(); ++i)
+		bytes += (size_t)image.ktx.levels[i].size;
+	return bytes;
+}
+
+// Keeps the chain buffer for the next decode, up to one per worker
+void TextureLoader::freePixels(Image& image)
+{
+	if (!image.chain.empty())
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (spareChains.size() < (size_t)MAX_WORKERS)
+		{
+			spareChains.push_back(std::vector<unsigned char>());
+			spareChains.back().swap(image.chain);
+		}
+	}
+	image.pixels = 0;
+	image.chain.clear();
+	image.file.clear();
+}
+
+// Frees the oldest ready image, which is done with whether it was uploaded or not
+void TextureLoader::popReady()
+{
+	// A cancelled image's name may already belong to a newer request
+	std::map<GLuint, uint32_t>::iterator found = inFlight.find(ready.front().texture);
+	if (found != inFlight.end() && found->second == ready.front().request)
+		inFlight.erase(found);
+	freePixels(ready.front());
+	ready.pop_front();
+
+	// Idle: the spare chains are only worth their memory while loads keep coming
+	if (--outstanding == 0)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		spareChains.clear();
+	}
+}
+
+// Returns a slot the GPU is done reading from, grown to hold size bytes, or null when all are in flight
+TextureLoader::StagingSlot* TextureLoader::acquireSlot(GLsizeiptr size, GLStateCache& state)
+{
+	for (int i = 0; i < STAGING_SLOTS; ++i)
+	{
+		StagingSlot& slot = slots[(nextSlot + i) % STAGING_SLOTS];
+		if (slot.fence)
+		{
+			GLenum status = glClientWaitSync(slot.fence, 0, 0);
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+				continue;
+			glDeleteSync(slot.fence);
+			slot.fence = 0;
+		}
+
+		// Immutable storage cannot grow, so a slot too small is replaced
+		if (slot.capacity < size)
+		{
+			const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			if (slot.buffer)
+			{
+				state.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0); // the name may come straight back from glGenBuffers
+				glDeleteBuffers(1, &slot.buffer);
+			}
+
+			glGenBuffers(1, &slot.buffer);
+			state.bindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+			glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, NULL, flags);
+			slot.mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+			slot.capacity = size;
+		}
+
+		nextSlot = (nextSlot + i + 1) % STAGING_SLOTS;
+		return &slot;
+	}
+	return 0;
+}
+
+// Copies the mip chain into a staging slot and respecifies the texture from it, level by level;
+// false when no slot is free
+bool TextureLoader::upload(const Image& image, GLStateCache& state)
+{
+	GLint internalFormat = image.channels == 3 ? GL_RGB8 : GL_RGBA8;
+	GLenum format = image.channels == 3 ? GL_RGB : GL_RGBA;
+
+	StagingSlot* slot = acquireSlot((GLsizeiptr)imageBytes(image), state);
+	if (!slot)
+		return false;
+	memcpy(slot->mapped, image.pixels, imageBytes(image));
+
+	state.bindBuffer(GL_PIXEL_UNPACK_BUFFER, slot->buffer);
+	state.activeTexture(GL_TEXTURE0);
+	state.bindTexture(GL_TEXTURE_2D, image.texture);
+
+	// RGB rows are not 4-byte aligned for every width
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	size_t offset = 0;
+	for (size_t i = 0; i < image.levels.size(); ++i)
+	{
+		const MipLevel& level = image.levels[i];
+		glTexImage2D(GL_TEXTURE_2D, (GLint)i, internalFormat, level.width, level.height, 0, format, GL_UNSIGNED_BYTE, (void*)offset);
+		offset += level.size;
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.levels.size() - 1);
+	// Trilinear over the uploaded chain; GL_LINEAR would only ever sample level 0
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, image.levels.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+
+	slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	state.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	return true;
+}
+
+// Uploads every level of a baked image as is, packed back to back in one staging slot
+bool TextureLoader::uploadKtx2(const Image& image, GLStateCache& state)
+{
+	StagingSlot* slot = acquireSlot((GLsizeiptr)imageBytes(image), state);
+	if (!slot)
+		return false;
+
+	state.bindBuffer(GL_PIXEL_UNPACK_BUFFER, slot->buffer);
+	state.activeTexture(GL_TEXTURE0);
+	state.bindTexture(GL_TEXTURE_2D, image.texture);
+
+	const GLenum format = internalFormat(image.ktx.vkFormat);
+	const bool compressed = Ktx2File::isCompressed(image.ktx.vkFormat);
+	const GLenum pixelFormat = Ktx2File::unormFormat(image.ktx.vkFormat) == KTX2_FORMAT_R8G8B8_UNORM ? GL_RGB : GL_RGBA;
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	size_t offset = 0;
+	for (size_t i = 0; i < image.ktx.levels.size(); ++i)
+	{
+		const Ktx2Level& level = image.ktx.levels[i];
+		memcpy(slot->mapped + offset, image.pixels + level.offset, (size_t)level.size);
+		if (compressed)
+			glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)i, format, level.width, level.height, 0, (GLsizei)level.size, (void*)offset);
+		else
+			glTexImage2D(GL_TEXTURE_2D, (GLint)i, format, level.width, level.height, 0, pixelFormat, GL_UNSIGNED_BYTE, (void*)offset);
+		offset += (size_t)level.size;
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.ktx.levels.size() - 1);
+	// Trilinear over the uploaded chain; GL_LINEAR would only ever sample level 0
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, image.ktx.levels.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+
+	slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	state.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	return true;
+}
+
+int TextureLoader::update(GLStateCache& state)
+{
+	if (outstanding == 0)
+		return 0;
+	CPU_PROFILE_FUNCTION();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		ready.insert(ready.end(), std::make_move_iterator(done.begin()), std::make_move_iterator(done.end()));
+		done.clear();
+	}
+
+	int uploaded = 0;
+	size_t uploadedBytes = 0;
+	while (!ready.empty())
+	{
+		Image& image = ready.front();
+		std::vector<uint32_t>::iterator dropped = std::find(cancelled.begin(), cancelled.end(), image.request);
+		if (dropped != cancelled.end())
+		{
+			cancelled.erase(dropped);
+			popReady();
+			continue;
+		}
+		if (!image.pixels)
+		{
+			std::cout << "Failed to load texture " << image.path << ": " << image.failure << std::endl;
+			++failures;
+			popReady();
+			continue;
+		}
+
+		size_t size = imageBytes(image);
+		if (uploadedBytes > 0 && uploadedBytes + size > UPLOAD_BUDGET_BYTES)
+			break;
+		const bool baked = !image.ktx.levels.empty();
+		if (!(baked ? uploadKtx2(image, state) : upload(image, state)))
+			break;
+
+		popReady();
+		++uploaded;
+		uploadedBytes += size;
+	}
+	return uploaded;
+}
+
+void TextureLoader::finish(GLStateCache& state)
+{
+	CPU_PROFILE_FUNCTION();
+	while (outstanding > 0)
+	{
+		if (update(state) > 0 || outstanding == 0)
+			continue;
+
+		if (ready.empty())
+		{
+			// Nothing decoded yet: sleep until a worker delivers
+			std::unique_lock<std::mutex> lock(mutex);
+			decoded.wait(lock, [this] { return !done.empty(); });
+		}
+		else
+		{
+			// Every staging slot is still being read; let the GPU drain them
+			glFinish();
+		}
+	}
+}
+
+void TextureLoader::shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		jobs.clear();
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+	workers.clear();
+
+	for (size_t i = 0; i < done.size(); ++i)
+		freePixels(done[i]);
+	done.clear();
+	for (size_t i = 0; i < ready.size(); ++i)
+		freePixels(ready[i]);
+	ready.clear();
+	spareChains.clear();
+	inFlight.clear();
+	cancelled.clear();
+	outstanding = 0;
+
+	for (int i = 0; i < STAGING_SLOTS; ++i)
+	{
+		StagingSlot& slot = slots[i];
+		if (slot.fence)
+			glDeleteSync(slot.fence);
+		if (slot.buffer)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			glDeleteBuffers(1, &slot.buffer);
+		}
+		slot.buffer = 0;
+		slot.mapped = 0;
+		slot.capacity = 0;
+		slot.fence = 0;
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include <GL/glew.h>
+#include "GLStateCache.h"
+#include "Ktx2File.h"
+#include "MipGenerator.h"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Loads 2D textures in the background. request() hands back a texture name right away,
+// holding a 1x1 placeholder; worker threads decode the file and update() uploads the
+// result on the GL thread through persistently mapped pixel buffers, respecifying the
+// same name. Materials and draws keep their texture name and pick up the image when it lands.
+// Workers decode straight into a buffer laid out as the whole mip chain, stb_image's working memory
+// coming from their DecodeArena, and fill in the smaller levels (MipGenerator); the GL thread only
+// copies the finished chain into a staging buffer. Chain buffers are reused until the loader goes idle.
+// KTX2 files baked by TextureBaker skip decoding: their block-compressed mip levels are
+// uploaded as they are, as are the pre-decoded ones of asset packs, which never reach a worker.
+// Every call except the workers' own is made on the GL thread.
+class TextureLoader
+{
+	static const int MAX_WORKERS = 4;
+	static const int STAGING_SLOTS = 3;
+	static const size_t UPLOAD_BUDGET_BYTES = 16 << 20; // per update(), at least one image always goes
+
+	struct Job
+	{
+		GLuint texture;
+		uint32_t request;              // numbers each request, so a reused texture name is told apart
+		std::string path;
+		std::vector<unsigned char> encoded; // file contents already in memory, empty to read path
+	};
+
+	// Decoded pixels, or null pixels when the file could not be loaded
+	struct Image
+	{
+		GLuint texture;
+		uint32_t request;
+		std::string path;
+		unsigned char* pixels;         // level 0 of chain, or the start of the KTX2 contents (only read)
+		int width;
+		int height;
+		int channels;
+		const char* failure;           // stb_image's reason, read on the worker since it is thread-local
+		std::vector<MipLevel> levels;  // decoded images: every level, packed back to back in chain
+		std::vector<unsigned char> chain; // at least as large as the levels, it may come from a larger image
+		std::vector<unsigned char> file; // KTX2 file contents when the loader owns them; ktx.levels index into pixels
+		Ktx2Image ktx;                 // no levels for images decoded by stb_image
+	};
+
+	// Pixel unpack buffer mapped for the lifetime of the loader; the fence guards the last upload from it
+	struct StagingSlot
+	{
+		GLuint buffer;
+		unsigned char* mapped;
+		GLsizeiptr capacity;
+		GLsync fence;
+	};
+
+	std::vector<std::thread> workers;
+	int mipThreads;                    // threads each worker spreads a mip chain over
+	std::mutex mutex;
+	std::condition_variable wake;      // jobs queued or stopping
+	std::condition_variable decoded;   // an image finished decoding
+	std::deque<Job> jobs;
+	std::deque<Image> done;
+	std::vector<std::vector<unsigned char> > spareChains; // from uploaded images, for the workers to decode into
+	bool stopping;
+
+	std::deque<Image> ready;           // taken from done, waiting for a staging slot or the next update()
+	std::map<GLuint, uint32_t> inFlight; // request of each texture not yet uploaded or failed
+	std::vector<uint32_t> cancelled;   // requests of deleted textures whose images are still being decoded
+	uint32_t nextRequest;
+	StagingSlot slots[STAGING_SLOTS];
+	int nextSlot;
+	size_t outstanding;                // requested and not yet uploaded or failed
+	size_t failures;                   // requested and could not be loaded
+
+	void startWorkers();
+	GLuint createPlaceholder(GLStateCache& state);
+	GLuint queue(Job& job, GLStateCache& state);
+	uint32_t track(GLuint texture);
+	static void parseKtx2(const unsigned char* data, size_t size, Image& image);
+	void decode(const std::vector<unsigned char>& encoded, Image& image);
+	void popReady();
+	void workerMain();
+	StagingSlot* acquireSlot(GLsizeiptr size, GLStateCache& state);
+	static size_t imageBytes(const Image& image);
+	void freePixels(Image& image);
+	bool upload(const Image& image, GLStateCache& state);
+	bool uploadKtx2(const Image& image, GLStateCache& state);
+
+public:
+	TextureLoader();
+	~TextureLoader();
+
+	// Creates the texture with its placeholder and queues the file for decoding
+	GLuint request(const char* path, GLStateCache& state);
+	// Same, decoding file contents the caller already read; path only names the texture in messages.
+	// Files whose contents are KTX2 are uploaded without decoding, whichever way they are requested.
+	GLuint request(const char* path, std::vector<unsigned char>& encoded, GLStateCache& state);
+	// Same for KTX2 contents that stay in memory until the texture is uploaded or cancelled, such as
+	// a blob of a mapped asset pack: the next update() uploads the levels straight from data.
+	GLuint request(const char* path, const unsigned char* data, size_t size, GLStateCache& state);
+
+	// Drops the pending image of a texture about to be deleted, so its name can be reused safely
+	void cancel(GLuint texture);
+
+	// Uploads decoded images, as many as fit the per-call budget and the free staging slots.
+	// Returns the number of textures that received their image.
+	int update(GLStateCache& state);
+
+	// Blocks until every requested texture is uploaded or has failed
+	void finish(GLStateCache& state);
+
+	size_t pending() const { return outstanding; }
+	// Textures whose file could not be read or decoded; they keep their placeholder
+	size_t failed() const { return failures; }
+
+	// Stops the workers and releases the staging buffers; the textures stay with the caller
+	void shutdown();
+};
@@ -0,0 +1,105 @@
+// Measures what orienting a texture costs at load time, on 4K and 8K RGB images:
+//   byte swap   - decode, then swap rows a byte at a time (the old flipImageVertically)
+//   stb flip    - decode with stb_image's flip flag, which swaps rows with memcpy
+//   no flip     - decode only; the vertex shader flips v instead
+// Images are synthesized as binary PPM in memory so the run needs no files and the
+// decode itself is a plain copy, leaving the orientation cost in plain view.
+//
+// Build and run on its own, for example:
+//   g++ -O2 -std=c++11 TextureOrientationBenchmark.cpp -o TextureOrientationBenchmark && ./TextureOrientationBenchmark
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+static const int CHANNELS = 3;
+static const int RUNS = 7;
+
+// The loop flipImageVertically ran after every stbi_load
+static void flipBytewise(unsigned char* image, int width, int height, int channels)
+{
+	for (int j = 0; j < height / 2; ++j)
+	{
+		int index1 = j * width * channels;
+		int index2 = (height - 1 - j) * width * channels;
+
+		for (int i = width * channels; i > 0; --i)
+		{
+			unsigned char tmp = image[index1];
+			image[index1] = image[index2];
+			image[index2] = tmp;
+			++index1;
+			++index2;
+		}
+	}
+}
+
+static std::vector<unsigned char> makePpm(int width, int height)
+{
+	char header[64];
+	int headerSize = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+
+	std::vector<unsigned char> file(headerSize + (size_t)width * height * CHANNELS);
+	std::copy(header, header + headerSize, file.begin());
+	uint32_t state = 2463534242u;
+	for (size_t i = headerSize; i < file.size(); ++i)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		file[i] = (unsigned char)state;
+	}
+	return file;
+}
+
+enum Method { BYTE_SWAP, STB_FLIP, NO_FLIP };
+
+// Median load time in ms
+static double timeLoad(const std::vector<unsigned char>& file, Method method)
+{
+	std::vector<double> times;
+	for (int run = 0; run < RUNS; ++run)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		stbi_set_flip_vertically_on_load(method == STB_FLIP ? 1 : 0);
+		int width, height, channels;
+		unsigned char* image = stbi_load_from_memory(file.data(), (int)file.size(), &width, &height, &channels, 0);
+		if (!image)
+		{
+			printf("Decode failed: %s\n", stbi_failure_reason());
+			exit(EXIT_FAILURE);
+		}
+		if (method == BYTE_SWAP)
+			flipBytewise(image, width, height, channels);
+
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		stbi_image_free(image);
+		times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+	}
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
+
+int main()
+{
+	const int sizes[] = { 4096, 8192 };
+	const char* labels[] = { "4K", "8K" };
+
+	printf("%-4s %12s %12s %12s\n", "size", "byte swap", "stb flip", "no flip");
+	for (int i = 0; i < 2; ++i)
+	{
+		std::vector<unsigned char> file = makePpm(sizes[i], sizes[i]);
+		double byteSwap = timeLoad(file, BYTE_SWAP);
+		double stbFlip = timeLoad(file, STB_FLIP);
+		double noFlip = timeLoad(file, NO_FLIP);
+		printf("%-4s %9.1f ms %9.1f ms %9.1f ms\n", labels[i], byteSwap, stbFlip, noFlip);
+	}
+	return EXIT_SUCCESS;
+}
@@ -18,6 +18,13 @@ enum Camera_Movement {
     DOWN
 };
 
+// Clipping planes of a view volume, stored as (normal, distance) with the normals pointing inside
+struct Frustum
+{
+    enum Plane { LEFT_PLANE, RIGHT_PLANE, BOTTOM_PLANE, TOP_PLANE, NEAR_PLANE, FAR_PLANE, PLANE_COUNT };
+    glm::vec4 planes[PLANE_COUNT];
+};
+
 // Default camera values
 const float YAW = -90.0f;
 const float PITCH = 0.0f;
@@ -69,6 +76,42 @@ public:
         return glm::lookAt(Position, Position + Front, Up);
     }
 
+    // returns the frustum planes of a combined projection * view matrix (Gribb/Hartmann plane extraction)
+    static Frustum ExtractFrustum(const glm::mat4& viewProjection)
+    {
+        // rows of the matrix (glm stores columns)
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; ++i)
+            rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+
+        Frustum frustum;
+        frustum.planes[Frustum::LEFT_PLANE] = rows[3] + rows[0];
+        frustum.planes[Frustum::RIGHT_PLANE] = rows[3] - rows[0];
+        frustum.planes[Frustum::BOTTOM_PLANE] = rows[3] + rows[1];
+        frustum.planes[Frustum::TOP_PLANE] = rows[3] - rows[1];
+        frustum.planes[Frustum::NEAR_PLANE] = rows[3] + rows[2];
+        frustum.planes[Frustum::FAR_PLANE] = rows[3] - rows[2];
+
+        // normalize so plane distances are in world units
+        for (int i = 0; i < Frustum::PLANE_COUNT; ++i)
+        {
+            glm::vec4& plane = frustum.planes[i];
+            float length = glm::length(glm::vec3(plane));
+            plane = plane / length;
+        }
+        return frustum;
+    }
+
+    // places the camera directly, e.g. from a recorded camera path
+    void SetPose(glm::vec3 position, float yaw, float pitch, float zoom)
+    {
+        Position = position;
+        Yaw = yaw;
+        Pitch = pitch;
+        Zoom = zoom;
+        updateCameraVectors();
+    }
+
     // processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
     void ProcessKeyboard(Camera_Movement direction, float deltaTime)
     {
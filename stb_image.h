@@ -32,6 +32,11 @@
    Full documentation under "DOCUMENTATION" below.
 LICENSE
   See end of file for license information.
+LOCAL CHANGES TO THIS COPY:
+      - stbi_load_into family: decode into caller memory (e.g. a mapped buffer) with a row stride
+      - filename loaders mmap regular files and decode from memory (POSIX; STBI_NO_MMAP to disable)
+      - AVX2 JPEG IDCT, YCbCr->RGB and 2x2 chroma upsampling, picked by cpuid (STBI_NO_AVX2 to disable)
+      - stbi_limit_jpeg_kernels: cap the JPEG kernels at scalar or 128-bit SIMD, for benchmarks
 RECENT REVISION HISTORY:
       2.28  (2023-01-29) many error fixes, security errors, just tons of stuff
       2.27  (2021-07-11) document stbi_info better, 16-bit PNM support, bug fixes
@@ -409,6 +414,20 @@ extern "C" {
     STBIDEF stbi_uc* stbi_load_gif_from_memory(stbi_uc const* buffer, int len, int** delays, int* x, int* y, int* z, int* comp, int req_comp);
 #endif
 
+    // Decode into caller memory: the final 8-bit pixels are written to 'dest', which the caller owns
+    // (it can be a mapped pixel buffer), instead of a new allocation. Row r of the image (after the
+    // vertical flip, if enabled) starts at dest + r * dest_stride, and dest_size bytes are available.
+    // Size the destination with stbi_info; the image has desired_channels components, or the file's
+    // count when desired_channels is 0. Returns 1 on success and 0 on failure, including when the
+    // image does not fit. JPEGs are color-converted straight into dest; other formats are decoded
+    // into a temporary buffer and copied once.
+    STBIDEF int      stbi_load_from_memory_into(stbi_uc const* buffer, int len, stbi_uc* dest, size_t dest_stride, size_t dest_size, int* x, int* y, int* channels_in_file, int desired_channels);
+    STBIDEF int      stbi_load_from_callbacks_into(stbi_io_callbacks const* clbk, void* user, stbi_uc* dest, size_t dest_stride, size_t dest_size, int* x, int* y, int* channels_in_file, int desired_channels);
+#ifndef STBI_NO_STDIO
+    STBIDEF int      stbi_load_into(char const* filename, stbi_uc* dest, size_t dest_stride, size_t dest_size, int* x, int* y, int* channels_in_file, int desired_channels);
+    STBIDEF int      stbi_load_from_file_into(FILE* f, stbi_uc* dest, size_t dest_stride, size_t dest_size, int* x, int* y, int* channels_in_file, int desired_channels);
+#endif
+
 #ifdef STBI_WINDOWS_UTF8
     STBIDEF int stbi_convert_wchar_to_utf8(char* buffer, size_t bufferlen, const wchar_t* input);
 #endif
@@ -500,6 +519,18 @@ extern "C" {
     STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_convert);
     STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
 
+    // cap the JPEG kernels picked at runtime, for benchmarks and for bisecting decode differences.
+    // the default, STBI_jpeg_simd256, uses AVX2 when the CPU has it, else SSE2/NEON like
+    // STBI_jpeg_simd128; STBI_jpeg_scalar uses the plain C kernels. all of them give identical pixels.
+    // set it before decoding starts: it isn't synchronized with decodes running on other threads
+    enum
+    {
+        STBI_jpeg_scalar = 0,
+        STBI_jpeg_simd128 = 1,
+        STBI_jpeg_simd256 = 2
+    };
+    STBIDEF void stbi_limit_jpeg_kernels(int widest);
+
     // ZLIB client - used by PNG, available for other purposes
 
     STBIDEF char* stbi_zlib_decode_malloc_guesssize(const char* buffer, int len, int initial_size, int* outlen);
@@ -574,6 +605,14 @@ extern "C" {
 #include <stdio.h>
 #endif
 
+// fileno and posix_madvise need POSIX.1-2001, which strict ISO C modes (-std=c99) hide on glibc
+#if !defined(STBI_NO_STDIO) && !defined(STBI_NO_MMAP) && !defined(_WIN32) \
+    && (defined(__APPLE__) || (defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200112L))
+#define STBI__MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #ifndef STBI_ASSERT
 #include <assert.h>
 #define STBI_ASSERT(x) assert(x)
@@ -750,6 +789,61 @@ static int stbi__sse2_available(void)
 #endif
 #endif
 
+// x86 AVX2, for the JPEG kernels only. Unlike SSE2 this is detected at runtime, since the
+// baseline build can't assume it: the kernels are compiled for AVX2 one function at a time
+// (a target attribute on GCC, Clang and clang-cl; MSVC emits any intrinsic without flags) and only
+// installed by stbi__setup_jpeg when cpuid and xgetbv say the CPU and OS support it.
+#if defined(STBI_SSE2) && !defined(STBI_NO_JPEG) && !defined(STBI_NO_AVX2) \
+    && (defined(_MSC_VER) ? _MSC_VER >= 1900 : (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#define STBI_AVX2
+#include <immintrin.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define STBI__AVX2_TARGET
+#else
+#define STBI__AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+#ifndef _MSC_VER
+#include <cpuid.h>
+#endif
+
+static int stbi__avx2_available(void)
+{
+#ifdef __AVX2__
+    // built with -mavx2 or /arch:AVX2, so everything else may use it already
+    return 1;
+#else
+    unsigned int info1[4], info7[4], xcr0_low;
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return 0;
+    __cpuid((int*)info1, 1);
+    __cpuidex((int*)info7, 7, 0);
+#else
+    if (__get_cpuid_max(0, 0) < 7) return 0;
+    __cpuid(1, info1[0], info1[1], info1[2], info1[3]);
+    __cpuid_count(7, 0, info7[0], info7[1], info7[2], info7[3]);
+#endif
+    // AVX and OSXSAVE, or xgetbv isn't there to ask
+    if ((info1[2] & (1u << 28 | 1u << 27)) != (1u << 28 | 1u << 27)) return 0;
+#if defined(_MSC_VER) && !defined(__clang__)
+    xcr0_low = (unsigned int)_xgetbv(0);
+#else
+    // inline asm, since clang's _xgetbv also wants the function compiled for xsave
+    {
+        unsigned int xcr0_high;
+        __asm__ __volatile__("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+    }
+#endif
+    // the OS has to save the XMM and YMM registers across context switches
+    if ((xcr0_low & 6) != 6) return 0;
+    return (info7[1] >> 5) & 1;
+#endif
+}
+#endif
+
 // ARM NEON
 #if defined(STBI_NO_SIMD) && defined(STBI_NEON)
 #undef STBI_NEON
@@ -793,6 +887,11 @@ typedef struct
 
     stbi_uc* img_buffer, * img_buffer_end;
     stbi_uc* img_buffer_original, * img_buffer_original_end;
+
+    // caller memory of the stbi_load_into family, NULL otherwise; decoders that can write
+    // their final rows there directly return dest
+    stbi_uc* dest;
+    size_t dest_stride, dest_size;
 } stbi__context;
 
 
@@ -806,6 +905,7 @@ static void stbi__start_mem(stbi__context* s, stbi_uc const* buffer, int len)
     s->callback_already_read = 0;
     s->img_buffer = s->img_buffer_original = (stbi_uc*)buffer;
     s->img_buffer_end = s->img_buffer_original_end = (stbi_uc*)buffer + len;
+    s->dest = NULL;
 }
 
 // initialize a callback-based context
@@ -819,6 +919,7 @@ static void stbi__start_callbacks(stbi__context* s, stbi_io_callbacks* c, void*
     s->img_buffer = s->img_buffer_original = s->buffer_start;
     stbi__refill_buffer(s);
     s->img_buffer_original_end = s->img_buffer_end;
+    s->dest = NULL;
 }
 
 #ifndef STBI_NO_STDIO
@@ -1094,6 +1195,13 @@ STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip)
     stbi__vertically_flip_on_load_global = flag_true_if_should_flip;
 }
 
+static int stbi__jpeg_kernel_limit = STBI_jpeg_simd256;
+
+STBIDEF void stbi_limit_jpeg_kernels(int widest)
+{
+    stbi__jpeg_kernel_limit = widest;
+}
+
 #ifndef STBI_THREAD_LOCAL
 #define stbi__vertically_flip_on_load  stbi__vertically_flip_on_load_global
 #else
@@ -1286,6 +1394,57 @@ static stbi__uint16* stbi__load_and_postprocess_16bit(stbi__context* s, int* x,
     return (stbi__uint16*)result;
 }
 
+// whether a w*h image of n 8-bit components fits the caller memory of the context
+static int stbi__dest_fits(stbi__context* s, int w, int h, int n)
+{
+    size_t row_bytes = (size_t)w * n;
+    if (row_bytes > s->dest_stride || row_bytes > s->dest_size) return 0;
+    return h <= 1 || (size_t)(h - 1) <= (s->dest_size - row_bytes) / s->dest_stride;
+}
+
+static int stbi__load_into(stbi__context* s, stbi_uc* dest, size_t dest_stride, size_t dest_size, int* x, int* y, int* comp, int req_comp)
+{
+    stbi__result_info ri;
+    void* result;
+    int file_comp, channels, row;
+    size_t row_bytes;
+
+    if (dest == NULL) return stbi__err("bad dest", "NULL destination");
+    if (comp == NULL) comp = &file_comp;
+    s->dest = dest;
+    s->dest_stride = dest_stride;
+    s->dest_size = dest_size;
+
+    result = stbi__load_main(s, x, y, comp, req_comp, &ri, 8);
+    if (result == NULL)
+        return 0;
+    if (result == dest) // written in place, flipped as it went
+        return 1;
+
+    // it is the responsibility of the loaders to make sure we get either 8 or 16 bit.
+    STBI_ASSERT(ri.bits_per_channel == 8 || ri.bits_per_channel == 16);
+
+    channels = req_comp ? req_comp : *comp;
+    if (ri.bits_per_channel != 8) {
+        result = stbi__convert_16_to_8((stbi__uint16*)result, *x, *y, channels);
+        if (result == NULL) return 0;
+    }
+
+    if (!stbi__dest_fits(s, *x, *y, channels)) {
+        STBI_FREE(result);
+        return stbi__err("dest too small", "Destination too small for image");
+    }
+
+    // the one copy, flipping by row order
+    row_bytes = (size_t)*x * channels;
+    for (row = 0; row < *y; ++row) {
+        int from = stbi__vertically_flip_on_load ? *y - 1 - row : row;
+        memcpy(dest + (size_t)row * dest_stride, (stbi_uc*)result + (size_t)from * row_bytes, row_bytes);
+    }
+    STBI_FREE(result);
+    return 1;
+}
+
 #if !defined(STBI_NO_HDR) && !defined(STBI_NO_LINEAR)
 static void stbi__float_postprocess(float* result, int* x, int* y, int* comp, int req_comp)
 {
@@ -1338,12 +1497,44 @@ static FILE* stbi__fopen(char const* filename, char const* mode)
     return f;
 }
 
+#ifdef STBI__MMAP
+// The filename loaders map a regular file whole and decode it through the memory path, so the
+// decoder reads the page cache directly instead of refilling the stdio buffer a few KB at a time.
+// Anything that can't be mapped (pipes, devices, empty files, files past INT_MAX) returns NULL
+// and is read through the FILE as before.
+static stbi_uc* stbi__mmap_file(FILE* f, size_t* size)
+{
+    struct stat st;
+    void* p;
+    if (fstat(fileno(f), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 || st.st_size > INT_MAX)
+        return NULL;
+    p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    posix_madvise(p, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+    *size = (size_t)st.st_size;
+    return (stbi_uc*)p;
+}
+#endif
+
 
 STBIDEF stbi_uc* stbi_load(char const* filename, int* x, int* y, int* comp, int req_comp)
 {
     FILE* f = stbi__fopen(filename, "rb");
     unsigned char* result;
+#ifdef STBI__MMAP
+    stbi_uc* mapped;
+    size_t size;
+#endif
     if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
+#ifdef STBI__MMAP
+    if ((mapped = stbi__mmap_file(f, &size)) != NULL) {
+        fclose(f);
+        result = stbi_load_from_memory(mapped, (int)size, x, y, comp, req_comp);
+        munmap(mapped, size);
+        return result;
+    }
+#endif
     result = stbi_load_from_file(f, x, y, comp, req_comp);
     fclose(f);
     return result;
@@ -1362,6 +1553,41 @@ STBIDEF stbi_uc* stbi_load_from_file(FILE* f, int* x, int* y, int* comp, int req
     return result;
 }
 
+STBIDEF int stbi_load_into(char const* filename, stbi_uc* dest, size_t dest_stride, size_t dest_size, int* x, int* y, int* comp, int req_comp)
+{
+    FILE* f = stbi__fopen(filename, "rb");
+    int result;
+#ifdef STBI__MMAP
+    stbi_uc* mapped;
+    size_t size;
+#endif
+    if (!f) return stbi__err("can't fopen", "Unable to open file");
+#ifdef STBI__MMAP
+    if ((mapped = stbi__mmap_file(f, &size)) != NULL) {
+        fclose(f);
+        result = stbi_load_from_memory_into(mapped, (int)size, dest, dest_stride, dest_size, x, y, comp, req_comp);
+        munmap(mapped, size);
+        return result;
+    }
+#endif
+    result = stbi_load_from_file_into(f, dest, dest_stride, dest_size, x, y, comp, req_comp);
+    fclose(f);
+    return result;
+}
+
+STBIDEF int stbi_load_from_file_into(FILE* f, stbi_uc* dest, size_t dest_stride, size_t dest_size, int* x, int* y, int* comp, int req_comp)
+{
+    int result;
+    stbi__context s;
+    stbi__start_file(&s, f);
+    result = stbi__load_into(&s, dest, dest_stride, dest_size, x, y, comp, req_comp);
+    if (result) {
+        // need to 'unget' all the characters in the IO buffer
+        fseek(f, -(int)(s.img_buffer_end - s.img_buffer), SEEK_CUR);
+    }
+    return result;
+}
+
 STBIDEF stbi__uint16* stbi_load_from_file_16(FILE* f, int* x, int* y, int* comp, int req_comp)
 {
     stbi__uint16* result;
@@ -1379,7 +1605,19 @@ STBIDEF stbi_us* stbi_load_16(char const* filename, int* x, int* y, int* comp, i
 {
     FILE* f = stbi__fopen(filename, "rb");
     stbi__uint16* result;
+#ifdef STBI__MMAP
+    stbi_uc* mapped;
+    size_t size;
+#endif
     if (!f) return (stbi_us*)stbi__errpuc("can't fopen", "Unable to open file");
+#ifdef STBI__MMAP
+    if ((mapped = stbi__mmap_file(f, &size)) != NULL) {
+        fclose(f);
+        result = stbi_load_16_from_memory(mapped, (int)size, x, y, comp, req_comp);
+        munmap(mapped, size);
+        return result;
+    }
+#endif
     result = stbi_load_from_file_16(f, x, y, comp, req_comp);
     fclose(f);
     return result;
@@ -1416,6 +1654,20 @@ STBIDEF stbi_uc* stbi_load_from_callbacks(stbi_io_callbacks const* clbk, void* u
     return stbi__load_and_postprocess_8bit(&s, x, y, comp, req_comp);
 }
 
+STBIDEF int stbi_load_from_memory_into(stbi_uc const* buffer, int len, stbi_uc* dest, size_t dest_stride, size_t dest_size, int* x, int* y, int* comp, int req_comp)
+{
+    stbi__context s;
+    stbi__start_mem(&s, buffer, len);
+    return stbi__load_into(&s, dest, dest_stride, dest_size, x, y, comp, req_comp);
+}
+
+STBIDEF int stbi_load_from_callbacks_into(stbi_io_callbacks const* clbk, void* user, stbi_uc* dest, size_t dest_stride, size_t dest_size, int* x, int* y, int* comp, int req_comp)
+{
+    stbi__context s;
+    stbi__start_callbacks(&s, (stbi_io_callbacks*)clbk, user);
+    return stbi__load_into(&s, dest, dest_stride, dest_size, x, y, comp, req_comp);
+}
+
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc* stbi_load_gif_from_memory(stbi_uc const* buffer, int len, int** delays, int* x, int* y, int* z, int* comp, int req_comp)
 {
@@ -1470,7 +1722,19 @@ STBIDEF float* stbi_loadf(char const* filename, int* x, int* y, int* comp, int r
 {
     float* result;
     FILE* f = stbi__fopen(filename, "rb");
+#ifdef STBI__MMAP
+    stbi_uc* mapped;
+    size_t size;
+#endif
     if (!f) return stbi__errpf("can't fopen", "Unable to open file");
+#ifdef STBI__MMAP
+    if ((mapped = stbi__mmap_file(f, &size)) != NULL) {
+        fclose(f);
+        result = stbi_loadf_from_memory(mapped, (int)size, x, y, comp, req_comp);
+        munmap(mapped, size);
+        return result;
+    }
+#endif
     result = stbi_loadf_from_file(f, x, y, comp, req_comp);
     fclose(f);
     return result;
@@ -2693,6 +2957,172 @@ static void stbi__idct_simd(stbi_uc* out, int out_stride, short data[64])
 
 #endif // STBI_SSE2
 
+#ifdef STBI_AVX2
+// avx2 integer IDCT. the same dataflow as stbi__idct_simd, and so bit-identical to it and to
+// the generic C version, but each pass keeps a row's eight 32-bit intermediates in one ymm
+// register instead of a lo/hi pair of xmm registers, halving the 32-bit arithmetic.
+// the 16-bit rows and the transposes stay 128-bit.
+STBI__AVX2_TARGET static void stbi__idct_avx2(stbi_uc* out, int out_stride, short data[64])
+{
+    __m128i row0, row1, row2, row3, row4, row5, row6, row7;
+    __m128i tmp;
+
+    // dot product constant: even elems=x, odd elems=y
+#define dct_const(x,y)  _mm256_setr_epi16((x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y))
+
+// out(0) = c0[even]*x + c0[odd]*y   (c0, x, y 16-bit, out 32-bit)
+// out(1) = c1[even]*x + c1[odd]*y
+#define dct_rot(out0,out1, x,y,c0,c1) \
+      __m256i c0##xy = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16((x),(y))), _mm_unpackhi_epi16((x),(y)), 1); \
+      __m256i out0 = _mm256_madd_epi16(c0##xy, c0); \
+      __m256i out1 = _mm256_madd_epi16(c0##xy, c1)
+
+   // out = in << 12  (in 16-bit, out 32-bit)
+#define dct_widen(out, in) \
+      __m256i out = _mm256_slli_epi32(_mm256_cvtepi16_epi32(in), 12)
+
+   // butterfly a/b, add bias, then shift by "s" and pack. packs works within 128-bit lanes,
+   // so the qwords come out as out0 lo, out1 lo, out0 hi, out1 hi and are put back in order
+#define dct_bfly32o(out0, out1, a,b,bias,s) \
+      { \
+         __m256i abiased = _mm256_add_epi32(a, bias); \
+         __m256i sum = _mm256_srai_epi32(_mm256_add_epi32(abiased, b), s); \
+         __m256i dif = _mm256_srai_epi32(_mm256_sub_epi32(abiased, b), s); \
+         __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(sum, dif), 0xd8); \
+         out0 = _mm256_castsi256_si128(packed); \
+         out1 = _mm256_extracti128_si256(packed, 1); \
+      }
+
+   // 8-bit interleave step (for transposes)
+#define dct_interleave8(a, b) \
+      tmp = a; \
+      a = _mm_unpacklo_epi8(a, b); \
+      b = _mm_unpackhi_epi8(tmp, b)
+
+   // 16-bit interleave step (for transposes)
+#define dct_interleave16(a, b) \
+      tmp = a; \
+      a = _mm_unpacklo_epi16(a, b); \
+      b = _mm_unpackhi_epi16(tmp, b)
+
+#define dct_pass(bias,shift) \
+      { \
+         /* even part */ \
+         dct_rot(t2e,t3e, row2,row6, rot0_0,rot0_1); \
+         __m128i sum04 = _mm_add_epi16(row0, row4); \
+         __m128i dif04 = _mm_sub_epi16(row0, row4); \
+         dct_widen(t0e, sum04); \
+         dct_widen(t1e, dif04); \
+         __m256i x0 = _mm256_add_epi32(t0e, t3e); \
+         __m256i x3 = _mm256_sub_epi32(t0e, t3e); \
+         __m256i x1 = _mm256_add_epi32(t1e, t2e); \
+         __m256i x2 = _mm256_sub_epi32(t1e, t2e); \
+         /* odd part */ \
+         dct_rot(y0o,y2o, row7,row3, rot2_0,rot2_1); \
+         dct_rot(y1o,y3o, row5,row1, rot3_0,rot3_1); \
+         __m128i sum17 = _mm_add_epi16(row1, row7); \
+         __m128i sum35 = _mm_add_epi16(row3, row5); \
+         dct_rot(y4o,y5o, sum17,sum35, rot1_0,rot1_1); \
+         __m256i x4 = _mm256_add_epi32(y0o, y4o); \
+         __m256i x5 = _mm256_add_epi32(y1o, y5o); \
+         __m256i x6 = _mm256_add_epi32(y2o, y5o); \
+         __m256i x7 = _mm256_add_epi32(y3o, y4o); \
+         dct_bfly32o(row0,row7, x0,x7,bias,shift); \
+         dct_bfly32o(row1,row6, x1,x6,bias,shift); \
+         dct_bfly32o(row2,row5, x2,x5,bias,shift); \
+         dct_bfly32o(row3,row4, x3,x4,bias,shift); \
+      }
+
+    __m256i rot0_0 = dct_const(stbi__f2f(0.5411961f), stbi__f2f(0.5411961f) + stbi__f2f(-1.847759065f));
+    __m256i rot0_1 = dct_const(stbi__f2f(0.5411961f) + stbi__f2f(0.765366865f), stbi__f2f(0.5411961f));
+    __m256i rot1_0 = dct_const(stbi__f2f(1.175875602f) + stbi__f2f(-0.899976223f), stbi__f2f(1.175875602f));
+    __m256i rot1_1 = dct_const(stbi__f2f(1.175875602f), stbi__f2f(1.175875602f) + stbi__f2f(-2.562915447f));
+    __m256i rot2_0 = dct_const(stbi__f2f(-1.961570560f) + stbi__f2f(0.298631336f), stbi__f2f(-1.961570560f));
+    __m256i rot2_1 = dct_const(stbi__f2f(-1.961570560f), stbi__f2f(-1.961570560f) + stbi__f2f(3.072711026f));
+    __m256i rot3_0 = dct_const(stbi__f2f(-0.390180644f) + stbi__f2f(2.053119869f), stbi__f2f(-0.390180644f));
+    __m256i rot3_1 = dct_const(stbi__f2f(-0.390180644f), stbi__f2f(-0.390180644f) + stbi__f2f(1.501321110f));
+
+    // rounding biases in column/row passes, see stbi__idct_block for explanation.
+    __m256i bias_0 = _mm256_set1_epi32(512);
+    __m256i bias_1 = _mm256_set1_epi32(65536 + (128 << 17));
+
+    // load
+    row0 = _mm_load_si128((const __m128i*) (data + 0 * 8));
+    row1 = _mm_load_si128((const __m128i*) (data + 1 * 8));
+    row2 = _mm_load_si128((const __m128i*) (data + 2 * 8));
+    row3 = _mm_load_si128((const __m128i*) (data + 3 * 8));
+    row4 = _mm_load_si128((const __m128i*) (data + 4 * 8));
+    row5 = _mm_load_si128((const __m128i*) (data + 5 * 8));
+    row6 = _mm_load_si128((const __m128i*) (data + 6 * 8));
+    row7 = _mm_load_si128((const __m128i*) (data + 7 * 8));
+
+    // column pass
+    dct_pass(bias_0, 10);
+
+    {
+        // 16bit 8x8 transpose pass 1
+        dct_interleave16(row0, row4);
+        dct_interleave16(row1, row5);
+        dct_interleave16(row2, row6);
+        dct_interleave16(row3, row7);
+
+        // transpose pass 2
+        dct_interleave16(row0, row2);
+        dct_interleave16(row1, row3);
+        dct_interleave16(row4, row6);
+        dct_interleave16(row5, row7);
+
+        // transpose pass 3
+        dct_interleave16(row0, row1);
+        dct_interleave16(row2, row3);
+        dct_interleave16(row4, row5);
+        dct_interleave16(row6, row7);
+    }
+
+    // row pass
+    dct_pass(bias_1, 17);
+
+    {
+        // pack
+        __m128i p0 = _mm_packus_epi16(row0, row1); // a0a1a2a3...a7b0b1b2b3...b7
+        __m128i p1 = _mm_packus_epi16(row2, row3);
+        __m128i p2 = _mm_packus_epi16(row4, row5);
+        __m128i p3 = _mm_packus_epi16(row6, row7);
+
+        // 8bit 8x8 transpose pass 1
+        dct_interleave8(p0, p2); // a0e0a1e1...
+        dct_interleave8(p1, p3); // c0g0c1g1...
+
+        // transpose pass 2
+        dct_interleave8(p0, p1); // a0c0e0g0...
+        dct_interleave8(p2, p3); // b0d0f0h0...
+
+        // transpose pass 3
+        dct_interleave8(p0, p2); // a0b0c0d0...
+        dct_interleave8(p1, p3); // a4b4c4d4...
+
+        // store
+        _mm_storel_epi64((__m128i*) out, p0); out += out_stride;
+        _mm_storel_epi64((__m128i*) out, _mm_shuffle_epi32(p0, 0x4e)); out += out_stride;
+        _mm_storel_epi64((__m128i*) out, p2); out += out_stride;
+        _mm_storel_epi64((__m128i*) out, _mm_shuffle_epi32(p2, 0x4e)); out += out_stride;
+        _mm_storel_epi64((__m128i*) out, p1); out += out_stride;
+        _mm_storel_epi64((__m128i*) out, _mm_shuffle_epi32(p1, 0x4e)); out += out_stride;
+        _mm_storel_epi64((__m128i*) out, p3); out += out_stride;
+        _mm_storel_epi64((__m128i*) out, _mm_shuffle_epi32(p3, 0x4e));
+    }
+
+#undef dct_const
+#undef dct_rot
+#undef dct_widen
+#undef dct_bfly32o
+#undef dct_interleave8
+#undef dct_interleave16
+#undef dct_pass
+}
+
+#endif // STBI_AVX2
+
 #ifdef STBI_NEON
 
 // NEON integer IDCT. should produce bit-identical
@@ -3641,6 +4071,82 @@ static stbi_uc* stbi__resample_row_hv_2_simd(stbi_uc* out, stbi_uc* in_near, stb
 }
 #endif
 
+#ifdef STBI_AVX2
+// stbi__resample_row_hv_2_simd 16 pixels at a time. the shifted copies of the current row
+// have to cross the 128-bit lanes, which alignr alone can't, so it is fed a lane-swapped copy.
+STBI__AVX2_TARGET static stbi_uc* stbi__resample_row_hv_2_avx2(stbi_uc* out, stbi_uc* in_near, stbi_uc* in_far, int w, int hs)
+{
+    int i = 0, t0, t1;
+
+    if (w == 1) {
+        out[0] = out[1] = stbi__div4(3 * in_near[0] + in_far[0] + 2);
+        return out;
+    }
+
+    t1 = 3 * in_near[0] + in_far[0];
+    // as in the sse2 version, the last pixel is left to the scalar tail for the boundary
+    for (; i < ((w - 1) & ~15); i += 16) {
+        // vertical filtering pass: 3*x + y = 4*x + (y - x)
+        __m256i farw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*) (in_far + i)));
+        __m256i nearw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*) (in_near + i)));
+        __m256i diff = _mm256_sub_epi16(farw, nearw);
+        __m256i nears = _mm256_slli_epi16(nearw, 2);
+        __m256i curr = _mm256_add_epi16(nears, diff); // current row
+
+        // "prev" is the current row shifted right by 1 pixel, with the previous pixel (t1)
+        // inserted; "next" is it shifted left by 1 pixel, with the first pixel of the next
+        // block of 16 added in.
+        __m256i lo_up = _mm256_permute2x128_si256(curr, curr, 0x08); // 0, curr lo
+        __m256i hi_down = _mm256_permute2x128_si256(curr, curr, 0x81); // curr hi, 0
+        __m256i prv0 = _mm256_alignr_epi8(curr, lo_up, 14);
+        __m256i nxt0 = _mm256_alignr_epi8(hi_down, curr, 2);
+        __m256i prev = _mm256_insert_epi16(prv0, (short)t1, 0);
+        __m256i next = _mm256_insert_epi16(nxt0, (short)(3 * in_near[i + 16] + in_far[i + 16]), 15);
+
+        // horizontal filter, polyphase:
+        // even pixels = 3*cur + prev = cur*4 + (prev - cur)
+        // odd  pixels = 3*cur + next = cur*4 + (next - cur)
+        __m256i bias = _mm256_set1_epi16(8);
+        __m256i curs = _mm256_slli_epi16(curr, 2);
+        __m256i prvd = _mm256_sub_epi16(prev, curr);
+        __m256i nxtd = _mm256_sub_epi16(next, curr);
+        __m256i curb = _mm256_add_epi16(curs, bias);
+        __m256i even = _mm256_add_epi16(prvd, curb);
+        __m256i odd = _mm256_add_epi16(nxtd, curb);
+
+        // interleave even and odd pixels, then undo scaling. unpack and pack both stay
+        // within lanes, so lane 0 ends up with pixels 0-7 and lane 1 with 8-15, in order
+        __m256i int0 = _mm256_unpacklo_epi16(even, odd);
+        __m256i int1 = _mm256_unpackhi_epi16(even, odd);
+        __m256i de0 = _mm256_srli_epi16(int0, 4);
+        __m256i de1 = _mm256_srli_epi16(int1, 4);
+
+        // pack and write output
+        __m256i outv = _mm256_packus_epi16(de0, de1);
+        _mm256_storeu_si256((__m256i*) (out + i * 2), outv);
+
+        // "previous" value for next iter
+        t1 = 3 * in_near[i + 15] + in_far[i + 15];
+    }
+
+    t0 = t1;
+    t1 = 3 * in_near[i] + in_far[i];
+    out[i * 2] = stbi__div16(3 * t1 + t0 + 8);
+
+    for (++i; i < w; ++i) {
+        t0 = t1;
+        t1 = 3 * in_near[i] + in_far[i];
+        out[i * 2 - 1] = stbi__div16(3 * t0 + t1 + 8);
+        out[i * 2] = stbi__div16(3 * t1 + t0 + 8);
+    }
+    out[w * 2 - 1] = stbi__div4(t1 + 2);
+
+    STBI_NOTUSED(hs);
+
+    return out;
+}
+#endif
+
 static stbi_uc* stbi__resample_row_generic(stbi_uc* out, stbi_uc* in_near, stbi_uc* in_far, int w, int hs)
 {
     // resample with nearest-neighbor
@@ -3815,6 +4321,74 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc* out, stbi_uc const* y, stbi_uc cons
 }
 #endif
 
+#ifdef STBI_AVX2
+// the step == 4 loop of stbi__YCbCr_to_RGB_simd 16 pixels at a time; anything left over,
+// and step == 3, goes to the sse2 version.
+STBI__AVX2_TARGET static void stbi__YCbCr_to_RGB_avx2(stbi_uc* out, stbi_uc const* y, stbi_uc const* pcb, stbi_uc const* pcr, int count, int step)
+{
+    int i = 0;
+
+    if (step == 4) {
+        __m128i signflip = _mm_set1_epi8(-0x80);
+        __m256i cr_const0 = _mm256_set1_epi16((short)(1.40200f * 4096.0f + 0.5f));
+        __m256i cr_const1 = _mm256_set1_epi16(-(short)(0.71414f * 4096.0f + 0.5f));
+        __m256i cb_const0 = _mm256_set1_epi16(-(short)(0.34414f * 4096.0f + 0.5f));
+        __m256i cb_const1 = _mm256_set1_epi16((short)(1.77200f * 4096.0f + 0.5f));
+        __m256i y_bias = _mm256_set1_epi16(128);
+        __m256i xw = _mm256_set1_epi16(255); // alpha channel
+
+        for (; i + 15 < count; i += 16) {
+            // load
+            __m128i y_bytes = _mm_loadu_si128((__m128i*) (y + i));
+            __m128i cr_bytes = _mm_loadu_si128((__m128i*) (pcr + i));
+            __m128i cb_bytes = _mm_loadu_si128((__m128i*) (pcb + i));
+            __m128i cr_biased = _mm_xor_si128(cr_bytes, signflip); // -128
+            __m128i cb_biased = _mm_xor_si128(cb_bytes, signflip); // -128
+
+            // widen to short as (y << 8) + 128, (cr - 128) << 8 and (cb - 128) << 8,
+            // the same words the sse2 version gets by unpacking
+            __m256i yw = _mm256_or_si256(_mm256_slli_epi16(_mm256_cvtepu8_epi16(y_bytes), 8), y_bias);
+            __m256i crw = _mm256_slli_epi16(_mm256_cvtepu8_epi16(cr_biased), 8);
+            __m256i cbw = _mm256_slli_epi16(_mm256_cvtepu8_epi16(cb_biased), 8);
+
+            // color transform
+            __m256i yws = _mm256_srli_epi16(yw, 4);
+            __m256i cr0 = _mm256_mulhi_epi16(cr_const0, crw);
+            __m256i cb0 = _mm256_mulhi_epi16(cb_const0, cbw);
+            __m256i cb1 = _mm256_mulhi_epi16(cbw, cb_const1);
+            __m256i cr1 = _mm256_mulhi_epi16(crw, cr_const1);
+            __m256i rws = _mm256_add_epi16(cr0, yws);
+            __m256i gwt = _mm256_add_epi16(cb0, yws);
+            __m256i bws = _mm256_add_epi16(yws, cb1);
+            __m256i gws = _mm256_add_epi16(gwt, cr1);
+
+            // descale
+            __m256i rw = _mm256_srai_epi16(rws, 4);
+            __m256i bw = _mm256_srai_epi16(bws, 4);
+            __m256i gw = _mm256_srai_epi16(gws, 4);
+
+            // back to byte, set up for transpose
+            __m256i brb = _mm256_packus_epi16(rw, bw);
+            __m256i gxb = _mm256_packus_epi16(gw, xw);
+
+            // transpose to interleave channels. this works within lanes, leaving pixels
+            // 0-3 and 8-11 in o0 and 4-7 and 12-15 in o1
+            __m256i t0 = _mm256_unpacklo_epi8(brb, gxb);
+            __m256i t1 = _mm256_unpackhi_epi8(brb, gxb);
+            __m256i o0 = _mm256_unpacklo_epi16(t0, t1);
+            __m256i o1 = _mm256_unpackhi_epi16(t0, t1);
+
+            // store
+            _mm256_storeu_si256((__m256i*) (out + 0), _mm256_permute2x128_si256(o0, o1, 0x20));
+            _mm256_storeu_si256((__m256i*) (out + 32), _mm256_permute2x128_si256(o0, o1, 0x31));
+            out += 64;
+        }
+    }
+
+    stbi__YCbCr_to_RGB_simd(out, y + i, pcb + i, pcr + i, count - i, step);
+}
+#endif
+
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg* j)
 {
@@ -3823,17 +4397,27 @@ static void stbi__setup_jpeg(stbi__jpeg* j)
     j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
 
 #ifdef STBI_SSE2
-    if (stbi__sse2_available()) {
+    if (stbi__jpeg_kernel_limit >= STBI_jpeg_simd128 && stbi__sse2_available()) {
         j->idct_block_kernel = stbi__idct_simd;
         j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
         j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
     }
 #endif
 
+#ifdef STBI_AVX2
+    if (stbi__jpeg_kernel_limit >= STBI_jpeg_simd256 && stbi__avx2_available()) {
+        j->idct_block_kernel = stbi__idct_avx2;
+        j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_avx2;
+        j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_avx2;
+    }
+#endif
+
 #ifdef STBI_NEON
-    j->idct_block_kernel = stbi__idct_simd;
-    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
-    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
+    if (stbi__jpeg_kernel_limit >= STBI_jpeg_simd128) {
+        j->idct_block_kernel = stbi__idct_simd;
+        j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
+        j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
+    }
 #endif
 }
 
@@ -3890,6 +4474,8 @@ static stbi_uc* load_jpeg_image(stbi__jpeg* z, int* out_x, int* out_y, int* comp
         int k;
         unsigned int i, j;
         stbi_uc* output;
+        size_t output_stride;
+        stbi_uc* tail_row = NULL;
         stbi_uc* coutput[4] = { NULL, NULL, NULL, NULL };
 
         stbi__resample res_comp[4];
@@ -3917,12 +4503,36 @@ static stbi_uc* load_jpeg_image(stbi__jpeg* z, int* out_x, int* out_y, int* comp
         }
 
         // can't error after this so, this is safe
-        output = (stbi_uc*)stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
-        if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+        if (z->s->dest) {
+            // stbi_load_into: color-convert straight into the caller's rows
+            if (!stbi__dest_fits(z->s, z->s->img_x, z->s->img_y, n)) { stbi__cleanup_jpeg(z); return stbi__errpuc("dest too small", "Destination too small for image"); }
+            output = z->s->dest;
+            output_stride = z->s->dest_stride;
+            // 3-component rows are converted 4 bytes per pixel, so they store a byte past their end:
+            // that byte is put back afterwards, and a row ending the caller's memory goes through tail_row
+            if (n == 3) {
+                tail_row = (stbi_uc*)stbi__malloc_mad2(n, z->s->img_x, 1);
+                if (!tail_row) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+            }
+        }
+        else {
+            output = (stbi_uc*)stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
+            if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+            output_stride = (size_t)n * z->s->img_x;
+        }
 
         // now go ahead and resample
         for (j = 0; j < z->s->img_y; ++j) {
-            stbi_uc* out = output + n * z->s->img_x * j;
+            unsigned int row = z->s->dest && stbi__vertically_flip_on_load ? z->s->img_y - 1 - j : j;
+            stbi_uc* row_start = output + output_stride * row;
+            stbi_uc* out = row_start;
+            stbi_uc past_row = 0;
+            if (tail_row) {
+                if (row_start + n * z->s->img_x < z->s->dest + z->s->dest_size)
+                    past_row = row_start[n * z->s->img_x];
+                else
+                    out = tail_row;
+            }
             for (k = 0; k < decode_n; ++k) {
                 stbi__resample* r = &res_comp[k];
                 int y_bot = r->ystep >= (r->vs >> 1);
@@ -4023,7 +4633,14 @@ static stbi_uc* load_jpeg_image(stbi__jpeg* z, int* out_x, int* out_y, int* comp
                         for (i = 0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
                 }
             }
+            if (tail_row) {
+                if (row_start + n * z->s->img_x < z->s->dest + z->s->dest_size)
+                    row_start[n * z->s->img_x] = past_row;
+                else
+                    memcpy(row_start, tail_row, n * z->s->img_x);
+            }
         }
+        STBI_FREE(tail_row);
         stbi__cleanup_jpeg(z);
         *out_x = z->s->img_x;
         *out_y = z->s->img_y;